@@ -7,6 +7,24 @@
 #include <vector>
 #include <algorithm>
 #include <ctime>
+#include <cstring>
+#include <map>
+#include <new>
+#include <cstdint>
+#include <cstddef>
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <type_traits>
+#include <string>
+#include <functional>
+#include <fcntl.h>                 // POSIX: trajectory files are memory-mapped
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
 #include "SDL2/SDL.h"
 #if defined(__ANDROID__) || defined(__IPHONEOS__)
@@ -16,144 +34,4617 @@
   #include <GLES/glext.h>
 #endif
 
+// -DCLOUD_STUB_GL: define every GL entry point we use as a counting no-op, so the
+// microbenchmarks (--bench-kernels) measure geometry cost on machines with no
+// display or GL driver. Link without -lGLESv1_CM. No window mode in this build.
+#ifdef CLOUD_STUB_GL
+struct StubGLCounters { unsigned long long calls, draws, verts; };
+static StubGLCounters g_stubGL;
+// noinline + compiler barrier: keep the cost of a real call and stop the
+// optimizer from folding a loop of stub calls into one counter update.
+#define STUB_GL(ret, name, params, body) \
+    extern "C" __attribute__((noinline)) ret GL_APIENTRY name params { \
+        ++g_stubGL.calls; body asm volatile("" ::: "memory"); }
+STUB_GL(void, glBindBuffer, (GLenum, GLuint), )
+STUB_GL(void, glBindTexture, (GLenum, GLuint), )
+STUB_GL(void, glBlendFunc, (GLenum, GLenum), )
+STUB_GL(void, glBufferData, (GLenum, GLsizeiptr, const void*, GLenum), )
+STUB_GL(void, glBufferSubData, (GLenum, GLintptr, GLsizeiptr, const void*), )
+STUB_GL(void, glClear, (GLbitfield), )
+STUB_GL(void, glClearColor, (GLfloat, GLfloat, GLfloat, GLfloat), )
+STUB_GL(void, glColor4f, (GLfloat, GLfloat, GLfloat, GLfloat), )
+STUB_GL(void, glColorPointer, (GLint, GLenum, GLsizei, const void*), )
+STUB_GL(void, glCopyTexSubImage2D, (GLenum, GLint, GLint, GLint, GLint, GLint, GLsizei, GLsizei), )
+STUB_GL(void, glDisable, (GLenum), )
+STUB_GL(void, glDisableClientState, (GLenum), )
+STUB_GL(void, glDrawArrays, (GLenum, GLint, GLsizei n), ++g_stubGL.draws; g_stubGL.verts += n;)
+STUB_GL(void, glDrawElements, (GLenum, GLsizei n, GLenum, const void*), ++g_stubGL.draws; g_stubGL.verts += n;)
+STUB_GL(void, glEnable, (GLenum), )
+STUB_GL(void, glEnableClientState, (GLenum), )
+STUB_GL(void, glFinish, (void), )
+STUB_GL(void, glGenBuffers, (GLsizei n, GLuint* b), for (GLsizei i=0; i<n; ++i) b[i] = (GLuint)(i+1);)
+STUB_GL(void, glGenTextures, (GLsizei n, GLuint* t), for (GLsizei i=0; i<n; ++i) t[i] = (GLuint)(i+1);)
+STUB_GL(void, glGetFloatv, (GLenum, GLfloat* v), v[0] = v[1] = 0.f;)
+STUB_GL(void, glGetIntegerv, (GLenum, GLint* v), *v = 4096;)
+STUB_GL(const GLubyte*, glGetString, (GLenum), return (const GLubyte*)"";)
+STUB_GL(void, glLoadIdentity, (void), )
+STUB_GL(void, glMatrixMode, (GLenum), )
+STUB_GL(void, glOrthof, (GLfloat, GLfloat, GLfloat, GLfloat, GLfloat, GLfloat), )
+STUB_GL(void, glPixelStorei, (GLenum, GLint), )
+STUB_GL(void, glPointSizePointerOES, (GLenum, GLsizei, const void*), )
+STUB_GL(void, glReadPixels, (GLint, GLint, GLsizei, GLsizei, GLenum, GLenum, void*), )
+STUB_GL(void, glShadeModel, (GLenum), )
+STUB_GL(void, glTexCoordPointer, (GLint, GLenum, GLsizei, const void*), )
+STUB_GL(void, glTexEnvi, (GLenum, GLenum, GLint), )
+STUB_GL(void, glTexImage2D, (GLenum, GLint, GLint, GLsizei, GLsizei, GLint, GLenum, GLenum, const void*), )
+STUB_GL(void, glTexParameteri, (GLenum, GLenum, GLint), )
+STUB_GL(void, glVertexPointer, (GLint, GLenum, GLsizei, const void*), )
+STUB_GL(void, glViewport, (GLint, GLint, GLsizei, GLsizei), )
+#undef STUB_GL
+#endif
+
+// SIMD width is picked at compile time (-mavx2 / SSE2 on x86-64); ARM and others use
+// the scalar path, which -DCLOUD_NO_SIMD also forces.
+#if defined(CLOUD_NO_SIMD)
+#elif defined(__AVX2__)
+  #include <immintrin.h>
+  #define CLOUD_SIMD_AVX2 1
+#elif defined(__SSE2__) || defined(_M_X64)
+  #include <emmintrin.h>
+  #define CLOUD_SIMD_SSE2 1
+#endif
+
+// ---------- allocation counting ----------
+// Replaces global operator new/delete so the main loop can prove it does no
+// C++ heap traffic after warmup. Build with -DCLOUD_NO_ALLOC_HOOK to drop it.
+static std::atomic<uint64_t> g_allocCount{0};
+
+#ifndef CLOUD_NO_ALLOC_HOOK
+void* operator new(size_t n) {
+    g_allocCount.fetch_add(1, std::memory_order_relaxed);
+    if (void* p = std::malloc(n ? n : 1)) return p;
+    throw std::bad_alloc();
+}
+void* operator new(size_t n, std::align_val_t al) {
+    g_allocCount.fetch_add(1, std::memory_order_relaxed);
+    void* p = nullptr;
+    if (posix_memalign(&p, std::max(sizeof(void*), (size_t)al), n ? n : 1) != 0) throw std::bad_alloc();
+    return p;
+}
+// Out of line so GCC doesn't pair an inlined free() with its built-in new and warn.
+__attribute__((noinline)) static void hookFree(void* p) noexcept { std::free(p); }
+void operator delete(void* p) noexcept                          { hookFree(p); }
+void operator delete(void* p, size_t) noexcept                  { hookFree(p); }
+void operator delete(void* p, std::align_val_t) noexcept         { hookFree(p); }
+void operator delete(void* p, size_t, std::align_val_t) noexcept { hookFree(p); }
+#endif
+
+// ---------- random numbers ----------
+// xoshiro128+ seeded through splitmix64: no shared lock like libc rand(), and a
+// run is fully determined by its seed. Each thread/simulation owns its own Rng;
+// jump() advances 2^64 draws to carve out non-overlapping streams.
+struct Rng {
+    uint32_t s[4];
+
+    explicit Rng(uint64_t seed = 1) {
+        for (int i=0; i<2; ++i) {
+            uint64_t z = (seed += 0x9e3779b97f4a7c15ull);
+            z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+            z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+            z ^= z >> 31;
+            s[2*i+0] = (uint32_t)z; s[2*i+1] = (uint32_t)(z >> 32);
+        }
+    }
+    static uint32_t rotl(uint32_t x, int k) { return (x << k) | (x >> (32 - k)); }
+    uint32_t next() {
+        const uint32_t result = s[0] + s[3];
+        const uint32_t t = s[1] << 9;
+        s[2] ^= s[0]; s[3] ^= s[1]; s[1] ^= s[2]; s[0] ^= s[3];
+        s[2] ^= t;
+        s[3] = rotl(s[3], 11);
+        return result;
+    }
+    // [0,1) from the top 24 bits (the low bits of xoshiro+ are weak).
+    float uniform() { return (next() >> 8) * (1.0f / 16777216.0f); }
+    void fill(float* out, size_t n) { for (size_t i=0; i<n; ++i) out[i] = uniform(); }
+
+    void jump() {
+        static const uint32_t J[4] = { 0x8764000b, 0xf542d2d3, 0x6fa035c3, 0x77f2db5b };
+        uint32_t t[4] = { 0, 0, 0, 0 };
+        for (int i=0; i<4; ++i)
+            for (int b=0; b<32; ++b) {
+                if (J[i] & (1u << b)) { t[0] ^= s[0]; t[1] ^= s[1]; t[2] ^= s[2]; t[3] ^= s[3]; }
+                next();
+            }
+        std::memcpy(s, t, sizeof s);
+    }
+};
+
+// ---------- vertex streaming ----------
+// With --vbo, per-frame geometry is copied into two ring-buffered VBOs (vertices
+// and indices) instead of being handed to the driver as client arrays, which it
+// must copy again on every draw. When a ring is full it is orphaned: glBufferData
+// with no data makes the driver hand out fresh storage, so frames the GPU is still
+// reading keep theirs and nothing stalls.
+struct StreamBuffer {
+    GLenum target = GL_ARRAY_BUFFER;
+    GLuint id = 0;
+    size_t capacity = 0, head = 0;
+    uint64_t bytes = 0, orphans = 0;
+
+    void init(GLenum t, size_t cap) {
+        target = t; capacity = cap; head = 0;
+        glGenBuffers(1, &id);
+        glBindBuffer(target, id);
+        glBufferData(target, (GLsizeiptr)capacity, nullptr, GL_DYNAMIC_DRAW);
+    }
+    // Copies n bytes in, leaves the buffer bound and returns their offset.
+    size_t upload(const void* data, size_t n) {
+        glBindBuffer(target, id);
+        if (head + n > capacity) {
+            while (capacity < n) capacity *= 2;
+            glBufferData(target, (GLsizeiptr)capacity, nullptr, GL_DYNAMIC_DRAW);
+            head = 0; ++orphans;
+        }
+        glBufferSubData(target, (GLintptr)head, (GLsizeiptr)n, data);
+        const size_t at = head;
+        head = (head + n + 15) & ~(size_t)15;
+        bytes += n;
+        return at;
+    }
+};
+
+struct StreamBuffers {
+    StreamBuffer verts, idx;
+    void init() { verts.init(GL_ARRAY_BUFFER, 4u << 20); idx.init(GL_ELEMENT_ARRAY_BUFFER, 1u << 20); }
+};
+static StreamBuffers* g_stream = nullptr;   // null: client arrays, as before --vbo
+
+// Array/index pointers for the next draw: streamed offsets with --vbo, otherwise
+// the client memory itself. Call streamDone() once the draws are issued.
+static const char* streamVerts(const void* data, size_t n) {
+    if (!g_stream) return (const char*)data;
+    return (const char*)nullptr + g_stream->verts.upload(data, n);
+}
+static const GLushort* streamIndices(const GLushort* data, size_t count) {
+    if (!g_stream) return data;
+    return (const GLushort*)((const char*)nullptr + g_stream->idx.upload(data, count*sizeof(GLushort)));
+}
+static void streamDone() {
+    if (!g_stream) return;
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+}
+
 // ---------- tiny helpers ----------
-static inline float frand() { return rand() / (float)RAND_MAX; }
 static inline float clampf(float x, float a, float b){ return std::max(a, std::min(b, x)); }
 
-// Solid color (RGBA)
-static inline void setColor(GLfloat r, GLfloat g, GLfloat b, GLfloat a=1.0f) { glColor4f(r,g,b,a); }
+// Solid color (RGBA)
+static inline void setColor(GLfloat r, GLfloat g, GLfloat b, GLfloat a=1.0f) { glColor4f(r,g,b,a); }
+
+// Vertex-colored rectangle (for gradients)
+static void fillRectGradient(GLfloat x, GLfloat y, GLfloat w, GLfloat h,
+                             const GLfloat c00[4], const GLfloat c10[4],
+                             const GLfloat c11[4], const GLfloat c01[4]) {
+    const GLfloat verts[] = { x, y,  x+w, y,  x+w, y+h,  x, y+h };
+    const GLfloat cols[]  = {
+        c00[0], c00[1], c00[2], c00[3],
+        c10[0], c10[1], c10[2], c10[3],
+        c11[0], c11[1], c11[2], c11[3],
+        c01[0], c01[1], c01[2], c01[3],
+    };
+    const GLushort idx[] = {0,1,2, 0,2,3};
+    glEnableClientState(GL_VERTEX_ARRAY);
+    glEnableClientState(GL_COLOR_ARRAY);
+    glVertexPointer(2, GL_FLOAT, 0, streamVerts(verts, sizeof verts));
+    glColorPointer (4, GL_FLOAT, 0, streamVerts(cols, sizeof cols));
+    glDrawElements(GL_TRIANGLES, 6, GL_UNSIGNED_SHORT, streamIndices(idx, 6));
+    streamDone();
+    glDisableClientState(GL_COLOR_ARRAY);
+    glDisableClientState(GL_VERTEX_ARRAY);
+}
+
+// Solid rectangle
+static void fillRect(GLfloat x, GLfloat y, GLfloat w, GLfloat h, const GLfloat c[4]) {
+    const GLfloat verts[] = { x, y,  x+w, y,  x+w, y+h,  x, y+h };
+    const GLushort idx[] = {0,1,2, 0,2,3};
+    glEnableClientState(GL_VERTEX_ARRAY);
+    glVertexPointer(2, GL_FLOAT, 0, streamVerts(verts, sizeof verts));
+    setColor(c[0],c[1],c[2],c[3]);
+    glDrawElements(GL_TRIANGLES, 6, GL_UNSIGNED_SHORT, streamIndices(idx, 6));
+    streamDone();
+    glDisableClientState(GL_VERTEX_ARRAY);
+}
+
+// ---------- frame profiler ----------
+// Scoped timers accumulate into the current frame; endFrame() pushes it into a
+// ring of the last kFrames frames, from which min/mean/p50/p99 are computed.
+// GL phases measure CPU-side submission; GPU time the driver defers shows up in swap.
+enum ProfPhase { PH_EVENTS, PH_WIND, PH_PROJECT, PH_SPAWN, PH_ATMOS, PH_UPDATE, PH_GRID, PH_MERGE, PH_SKY, PH_GROUND, PH_CLOUDS, PH_SUN, PH_CAPTURE, PH_SWAP, PH_COUNT };
+static const char* const kPhaseNames[PH_COUNT] = {
+    "events", "wind", "project", "spawn", "atmos", "update", "grid", "merge", "sky", "ground", "clouds", "sun", "capture", "swap"
+};
+static const GLfloat kPhaseColors[PH_COUNT][4] = {
+    {0.6f,0.6f,0.6f,0.9f}, {0.4f,0.8f,0.4f,0.9f}, {0.8f,0.3f,0.3f,0.9f}, {0.9f,0.8f,0.2f,0.9f},
+    {0.5f,0.3f,0.9f,0.9f}, {0.9f,0.4f,0.1f,0.9f}, {0.2f,0.8f,0.8f,0.9f}, {0.1f,0.5f,0.5f,0.9f},
+    {0.3f,0.5f,1.0f,0.9f}, {0.2f,0.7f,0.2f,0.9f}, {1.0f,1.0f,1.0f,0.9f}, {1.0f,0.6f,0.8f,0.9f},
+    {0.9f,0.2f,0.5f,0.9f}, {0.6f,0.2f,0.8f,0.9f},
+};
+
+class FrameProfiler {
+public:
+    enum { kFrames = 1024 };
+    bool enabled = false;
+    bool overlay = false;
+
+    FrameProfiler() { std::fill(cur_, cur_ + PH_COUNT, 0.0); }
+
+    // Only the thread that calls endFrame() owns the profiler; scopes opened on
+    // other threads (e.g. the --sim-thread ticker) are ignored.
+    bool owns() const { return owner_ == std::this_thread::get_id(); }
+    void start() { enabled = true; owner_ = std::this_thread::get_id(); }
+
+    void add(ProfPhase ph, double ms) { cur_[ph] += ms; }
+    void endFrame() {
+        if (!enabled) return;
+        double* row = ring_[head_];
+        for (int p=0; p<PH_COUNT; ++p) { row[p] = cur_[p]; cur_[p] = 0.0; }
+        head_ = (head_ + 1) % kFrames;
+        if (count_ < kFrames) ++count_;
+        ++total_;
+    }
+
+    struct Stats { double min, mean, p50, p99; };
+    Stats stats(int ph) const {   // ph == PH_COUNT → whole frame
+        Stats st{ 0, 0, 0, 0 };
+        if (!count_) return st;
+        std::vector<double> v(count_);
+        for (size_t i=0; i<count_; ++i) v[i] = sample(i, ph);
+        std::sort(v.begin(), v.end());
+        double sum = 0; for (double d : v) sum += d;
+        st.min = v.front(); st.mean = sum / count_;
+        st.p50 = v[(count_-1)/2]; st.p99 = v[(size_t)((count_-1)*0.99)];
+        return st;
+    }
+
+    // i = 0 is the oldest frame still in the ring.
+    double sample(size_t i, int ph) const {
+        const double* row = ring_[(head_ + kFrames - count_ + i) % kFrames];
+        if (ph < PH_COUNT) return row[ph];
+        double t = 0; for (int p=0; p<PH_COUNT; ++p) t += row[p];
+        return t;
+    }
+    size_t frames() const { return count_; }
+
+    void printSummary(FILE* f) const {
+        std::fprintf(f, "profile over last %zu of %llu frames (ms):\n", count_, (unsigned long long)total_);
+        std::fprintf(f, "  %-8s %9s %9s %9s %9s\n", "phase", "min", "mean", "p50", "p99");
+        for (int p=0; p<=PH_COUNT; ++p) {
+            Stats st = stats(p);
+            std::fprintf(f, "  %-8s %9.3f %9.3f %9.3f %9.3f\n", p < PH_COUNT ? kPhaseNames[p] : "frame",
+                         st.min, st.mean, st.p50, st.p99);
+        }
+    }
+
+    // .json → summary stats plus per-frame samples; anything else → CSV, one row per frame.
+    bool dump(const char* path) const {
+        FILE* f = std::fopen(path, "w");
+        if (!f) { std::fprintf(stderr, "profile: cannot write %s\n", path); return false; }
+        size_t len = std::strlen(path);
+        if (len >= 5 && !std::strcmp(path + len - 5, ".json")) {
+            std::fprintf(f, "{\n  \"frames\": %zu,\n  \"stats_ms\": {\n", count_);
+            for (int p=0; p<=PH_COUNT; ++p) {
+                Stats st = stats(p);
+                std::fprintf(f, "    \"%s\": {\"min\": %.4f, \"mean\": %.4f, \"p50\": %.4f, \"p99\": %.4f}%s\n",
+                             p < PH_COUNT ? kPhaseNames[p] : "frame", st.min, st.mean, st.p50, st.p99,
+                             p < PH_COUNT ? "," : "");
+            }
+            std::fprintf(f, "  },\n  \"phases\": [");
+            for (int p=0; p<PH_COUNT; ++p) std::fprintf(f, "%s\"%s\"", p ? ", " : "", kPhaseNames[p]);
+            std::fprintf(f, "],\n  \"samples_ms\": [\n");
+            for (size_t i=0; i<count_; ++i) {
+                std::fprintf(f, "    [");
+                for (int p=0; p<PH_COUNT; ++p) std::fprintf(f, "%s%.4f", p ? ", " : "", sample(i, p));
+                std::fprintf(f, "]%s\n", i+1 < count_ ? "," : "");
+            }
+            std::fprintf(f, "  ]\n}\n");
+        } else {
+            std::fprintf(f, "frame");
+            for (int p=0; p<PH_COUNT; ++p) std::fprintf(f, ",%s_ms", kPhaseNames[p]);
+            std::fprintf(f, ",total_ms\n");
+            for (size_t i=0; i<count_; ++i) {
+                std::fprintf(f, "%zu", i);
+                for (int p=0; p<PH_COUNT; ++p) std::fprintf(f, ",%.4f", sample(i, p));
+                std::fprintf(f, ",%.4f\n", sample(i, PH_COUNT));
+            }
+        }
+        std::fclose(f);
+        return true;
+    }
+
+private:
+    double cur_[PH_COUNT];
+    double ring_[kFrames][PH_COUNT] = {};
+    size_t head_ = 0, count_ = 0;
+    uint64_t total_ = 0;
+    std::thread::id owner_;
+};
+
+static FrameProfiler g_prof;
+
+class ProfScope {
+public:
+    explicit ProfScope(ProfPhase ph) : ph_(ph), on_(g_prof.enabled && g_prof.owns()) {
+        if (on_) t0_ = std::chrono::steady_clock::now();
+    }
+    ~ProfScope() {
+        if (on_) g_prof.add(ph_, std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - t0_).count());
+    }
+private:
+    ProfPhase ph_;
+    bool on_;
+    std::chrono::steady_clock::time_point t0_;
+};
+#define PROF_CAT2(a, b) a##b
+#define PROF_CAT(a, b) PROF_CAT2(a, b)
+#define PROF_SCOPE(ph) ProfScope PROF_CAT(profScope_, __LINE__)(ph)
+
+// Stacked bar per frame (newest at the right), 3 px per ms, with a 60 Hz guide.
+// Bars are clipped at the 100 px panel, so frames over about 33 ms read as full.
+static void drawProfileOverlay(const FrameProfiler& prof, int winW, int winH) {
+    const int kBars = 240;
+    const GLfloat x0 = 10.f, y0 = winH - 110.f, barW = 2.f, scale = 3.f;   // 3 px per ms
+    const GLfloat bg[4] = {0.f, 0.f, 0.f, 0.45f};
+    fillRect(x0 - 4.f, y0 - 4.f, kBars*barW + 8.f, 100.f + 8.f, bg);
+    size_t n = std::min((size_t)kBars, prof.frames());
+    size_t first = prof.frames() - n;
+    for (size_t i=0; i<n; ++i) {
+        GLfloat y = y0;
+        for (int p=0; p<PH_COUNT; ++p) {
+            GLfloat h = (GLfloat)prof.sample(first + i, p) * scale;
+            if (y + h > y0 + 100.f) h = y0 + 100.f - y;
+            if (h > 0.f) fillRect(x0 + i*barW, y, barW, h, kPhaseColors[p]);
+            y += h;
+        }
+    }
+    const GLfloat guide[4] = {1.f, 0.2f, 0.2f, 0.8f};
+    fillRect(x0, y0 + 16.67f*scale, kBars*barW, 1.f, guide);
+    (void)winW;
+}
+
+// ---------- blob geometry ----------
+// Unit circle for a given slice count, built once: (cos,sin) pairs for s=0..slices.
+// Ring fans are then just scale+translate of this table.
+struct UnitCircle {
+    int slices;
+    std::vector<GLfloat> cs;   // 2*(slices+1)
+};
+
+static const UnitCircle& unitCircle(int slices) {
+    static std::map<int, UnitCircle> cache;   // node-based: references stay valid
+    auto it = cache.find(slices);
+    if (it != cache.end()) return it->second;
+    UnitCircle& uc = cache[slices];
+    uc.slices = slices;
+    uc.cs.resize((size_t)2*(slices+1));
+    for (int s=0; s<=slices; ++s) {
+        float ang = (float)s / slices * 2.0f * (float)M_PI;
+        uc.cs[2*s+0] = std::cos(ang);
+        uc.cs[2*s+1] = std::sin(ang);
+    }
+    return uc;
+}
+
+// Per-ring radius fraction and alpha falloff pow(1-t,1.6) for a given ring count.
+struct RingProfile {
+    int rings;
+    std::vector<float> t, fall;
+};
+
+static const RingProfile& ringProfile(int rings) {
+    static std::map<int, RingProfile> cache;
+    auto it = cache.find(rings);
+    if (it != cache.end()) return it->second;
+    RingProfile& rp = cache[rings];
+    rp.rings = rings;
+    rp.t.resize(rings); rp.fall.resize(rings);
+    for (int i=0; i<rings; ++i) {
+        rp.t[i]    = (i+1)/(float)rings;
+        rp.fall[i] = std::pow(1.0f - rp.t[i], 1.6f);
+    }
+    return rp;
+}
+
+// Write one triangle fan (center + slices+1 rim points) into out; returns vertex count.
+static inline int buildRingFan(GLfloat* out, const UnitCircle& uc,
+                               GLfloat cx, GLfloat cy, GLfloat r) {
+    const GLfloat* cs = uc.cs.data();
+    out[0] = cx; out[1] = cy;
+    for (int s=0; s<=uc.slices; ++s) {
+        out[2+2*s+0] = cx + r*cs[2*s+0];
+        out[2+2*s+1] = cy + r*cs[2*s+1];
+    }
+    return uc.slices + 2;
+}
+
+static const int kBlobSlices = 32;
+static bool g_useFanCache = true;          // false → original per-ring trig + vector path (for A/B)
+static std::vector<GLfloat> g_fanScratch;  // reused vertex scratch, grows once
+
+// Soft “blob” disc: layered rings with fading alpha (cheap radial falloff)
+static void drawSoftBlob(GLfloat cx, GLfloat cy, GLfloat R,
+                         const GLfloat rgb[3], float alphaPeak=0.18f, int rings=8) {
+    if (!g_useFanCache) {
+        // Draw smaller to larger discs, each with lower alpha — gives smooth edges.
+        for (int i=0; i<rings; ++i) {
+            float t = (i+1)/(float)rings;                 // 0..1
+            float r = t*R;
+            float a = alphaPeak * std::pow(1.0f - t, 1.6f);
+            // Triangle fan
+            const int slices = kBlobSlices;
+            std::vector<GLfloat> v; v.reserve((size_t)2*(slices+2));
+            v.push_back(cx); v.push_back(cy);
+            for (int s=0; s<=slices; ++s) {
+                float ang = (float)s / slices * 2.0f * (float)M_PI;
+                v.push_back(cx + r*std::cos(ang));
+                v.push_back(cy + r*std::sin(ang));
+            }
+            glEnableClientState(GL_VERTEX_ARRAY);
+            glVertexPointer(2, GL_FLOAT, 0, v.data());
+            glColor4f(rgb[0], rgb[1], rgb[2], a);
+            glDrawArrays(GL_TRIANGLE_FAN, 0, (GLsizei)(v.size()/2));
+            glDisableClientState(GL_VERTEX_ARRAY);
+        }
+        return;
+    }
+    const UnitCircle&  uc = unitCircle(kBlobSlices);
+    const RingProfile& rp = ringProfile(rings);
+    const size_t need = (size_t)2*(uc.slices+2);
+    glEnableClientState(GL_VERTEX_ARRAY);
+    if (g_stream) {
+        // All rings in one upload; each fan is drawn from its offset.
+        if (g_fanScratch.size() < need*rings) g_fanScratch.resize(need*rings);
+        GLfloat* v = g_fanScratch.data();
+        int n = 0;
+        for (int i=0; i<rings; ++i) n = buildRingFan(v + need*i, uc, cx, cy, rp.t[i]*R);
+        glVertexPointer(2, GL_FLOAT, 0, streamVerts(v, need*rings*sizeof(GLfloat)));
+        for (int i=0; i<rings; ++i) {
+            glColor4f(rgb[0], rgb[1], rgb[2], alphaPeak * rp.fall[i]);
+            glDrawArrays(GL_TRIANGLE_FAN, (GLint)(i*(need/2)), (GLsizei)n);
+        }
+        streamDone();
+        glDisableClientState(GL_VERTEX_ARRAY);
+        return;
+    }
+    if (g_fanScratch.size() < need) g_fanScratch.resize(need);
+    GLfloat* v = g_fanScratch.data();
+    glVertexPointer(2, GL_FLOAT, 0, v);
+    for (int i=0; i<rings; ++i) {
+        int n = buildRingFan(v, uc, cx, cy, rp.t[i]*R);
+        glColor4f(rgb[0], rgb[1], rgb[2], alphaPeak * rp.fall[i]);
+        glDrawArrays(GL_TRIANGLE_FAN, 0, (GLsizei)n);
+    }
+    glDisableClientState(GL_VERTEX_ARRAY);
+}
+
+// ---------- SIMD lanes ----------
+// Kernels are written once against these lane types; ScalarF handles tails and
+// targets without SSE2/AVX2.
+struct ScalarF {
+    typedef float T;
+    typedef bool  M;
+    enum { N = 1 };
+    static T load(const float* p)        { return *p; }
+    static void store(float* p, T v)     { *p = v; }
+    static T set1(float v)               { return v; }
+    static T add(T a, T b)               { return a + b; }
+    static T sub(T a, T b)               { return a - b; }
+    static T mul(T a, T b)               { return a * b; }
+    static T div(T a, T b)               { return a / b; }
+    static T min(T a, T b)               { return b < a ? b : a; }
+    static T max(T a, T b)               { return a < b ? b : a; }
+    static T round(T v)                  { return std::nearbyint(v); }
+    static T floor(T v)                  { return std::floor(v); }
+    static M lt(T a, T b)                { return a < b; }
+    static M gt(T a, T b)                { return a > b; }
+    static M orm(M a, M b)               { return a || b; }
+    static T select(M m, T a, T b)       { return m ? a : b; }
+    static int bits(M m)                 { return m ? 1 : 0; }
+    // Table lookups: idx holds exact non-negative integers below 2^24.
+    typedef int32_t I;
+    static I index(T idx)                { return (int32_t)idx; }
+    static T gather(const float* p, I i) { return p[i]; }
+};
+
+#if CLOUD_SIMD_AVX2
+struct SimdF {
+    typedef __m256 T;
+    typedef __m256 M;
+    enum { N = 8 };
+    static T load(const float* p)        { return _mm256_loadu_ps(p); }
+    static void store(float* p, T v)     { _mm256_storeu_ps(p, v); }
+    static T set1(float v)               { return _mm256_set1_ps(v); }
+    static T add(T a, T b)               { return _mm256_add_ps(a, b); }
+    static T sub(T a, T b)               { return _mm256_sub_ps(a, b); }
+    static T mul(T a, T b)               { return _mm256_mul_ps(a, b); }
+    static T div(T a, T b)               { return _mm256_div_ps(a, b); }
+    static T min(T a, T b)               { return _mm256_min_ps(a, b); }
+    static T max(T a, T b)               { return _mm256_max_ps(a, b); }
+    static T round(T v)                  { return _mm256_round_ps(v, _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC); }
+    static T floor(T v)                  { return _mm256_floor_ps(v); }
+    static M lt(T a, T b)                { return _mm256_cmp_ps(a, b, _CMP_LT_OQ); }
+    static M gt(T a, T b)                { return _mm256_cmp_ps(a, b, _CMP_GT_OQ); }
+    static M orm(M a, M b)               { return _mm256_or_ps(a, b); }
+    static T select(M m, T a, T b)       { return _mm256_blendv_ps(b, a, m); }
+    static int bits(M m)                 { return _mm256_movemask_ps(m); }
+    typedef __m256i I;
+    static I index(T idx)                { return _mm256_cvttps_epi32(idx); }
+    static T gather(const float* p, I i) { return _mm256_i32gather_ps(p, i, 4); }
+};
+#elif CLOUD_SIMD_SSE2
+struct SimdF {
+    typedef __m128 T;
+    typedef __m128 M;
+    enum { N = 4 };
+    static T load(const float* p)        { return _mm_loadu_ps(p); }
+    static void store(float* p, T v)     { _mm_storeu_ps(p, v); }
+    static T set1(float v)               { return _mm_set1_ps(v); }
+    static T add(T a, T b)               { return _mm_add_ps(a, b); }
+    static T sub(T a, T b)               { return _mm_sub_ps(a, b); }
+    static T mul(T a, T b)               { return _mm_mul_ps(a, b); }
+    static T div(T a, T b)               { return _mm_div_ps(a, b); }
+    static T min(T a, T b)               { return _mm_min_ps(a, b); }
+    static T max(T a, T b)               { return _mm_max_ps(a, b); }
+    static T round(T v)                  { return _mm_cvtepi32_ps(_mm_cvtps_epi32(v)); }  // nearest-even, as nearbyint
+    static T floor(T v) {                // no roundps before SSE4.1: truncate, then fix negatives
+        T t = _mm_cvtepi32_ps(_mm_cvttps_epi32(v));
+        return _mm_sub_ps(t, _mm_and_ps(_mm_cmpgt_ps(t, v), _mm_set1_ps(1.f)));
+    }
+    static M lt(T a, T b)                { return _mm_cmplt_ps(a, b); }
+    static M gt(T a, T b)                { return _mm_cmpgt_ps(a, b); }
+    static M orm(M a, M b)               { return _mm_or_ps(a, b); }
+    static T select(M m, T a, T b)       { return _mm_or_ps(_mm_and_ps(m, a), _mm_andnot_ps(m, b)); }
+    static int bits(M m)                 { return _mm_movemask_ps(m); }
+    typedef __m128i I;                   // SSE2 has no gather: four scalar loads
+    static I index(T idx)                { return _mm_cvttps_epi32(idx); }
+    static T gather(const float* p, I i) {
+        alignas(16) int32_t k[4];
+        _mm_store_si128((__m128i*)k, i);
+        return _mm_setr_ps(p[k[0]], p[k[1]], p[k[2]], p[k[3]]);
+    }
+};
+#else
+typedef ScalarF SimdF;
+#endif
+
+// sin(x): reduce to [-pi,pi], fold to [-pi/2,pi/2], then an odd 9th-order
+// polynomial (|err| < 4e-6). Same operation order on every lane type.
+template <class V>
+static inline typename V::T fastSin(typename V::T x) {
+    typedef typename V::T T;
+    T k = V::round(V::mul(x, V::set1(0.159154943f)));
+    x = V::sub(x, V::mul(k, V::set1(6.28318531f)));
+    const T hp = V::set1(1.57079633f);
+    const T pi = V::set1(3.14159265f);
+    x = V::select(V::gt(x, hp), V::sub(pi, x), x);
+    x = V::select(V::lt(x, V::sub(V::set1(0.f), hp)), V::sub(V::sub(V::set1(0.f), pi), x), x);
+    T x2 = V::mul(x, x);
+    T p = V::set1(2.75573192e-6f);
+    p = V::add(V::mul(p, x2), V::set1(-1.98412698e-4f));
+    p = V::add(V::mul(p, x2), V::set1( 8.33333333e-3f));
+    p = V::add(V::mul(p, x2), V::set1(-1.66666667e-1f));
+    p = V::add(V::mul(p, x2), V::set1(1.f));
+    return V::mul(p, x);
+}
+
+// ---------- task pool ----------
+// Persistent workers for data-parallel loops. parallelFor(chunks, fn) deals the
+// chunk range out evenly; a worker drains its own range from the front and, when
+// empty, steals the back half of someone else's, so an uneven chunk (an emitter
+// hotspot, a dense grid cell) doesn't leave cores idle. The calling thread works
+// too, as worker 0. Chunk → data mapping is fixed by the caller, so results never
+// depend on which worker ran what.
+class TaskPool {
+public:
+    explicit TaskPool(int threads) : n_(std::max(1, threads)), ranges_(new Range[n_]) {
+        for (int i=1; i<n_; ++i) workers_.emplace_back([this, i]{ workerLoop(i); });
+    }
+    ~TaskPool() {
+        { std::lock_guard<std::mutex> lk(m_); quit_ = true; ++gen_; }
+        wake_.notify_all();
+        for (auto& t : workers_) t.join();
+    }
+    TaskPool(const TaskPool&) = delete;
+    TaskPool& operator=(const TaskPool&) = delete;
+
+    int size() const { return n_; }
+
+    // fn(chunk, worker) for every chunk in [0, chunks); returns when all are done.
+    template <class F> void parallelFor(size_t chunks, F&& fn) {
+        typedef typename std::remove_reference<F>::type Fn;
+        if (n_ == 1 || chunks <= 1) { for (size_t c=0; c<chunks; ++c) fn(c, 0); return; }
+        ctx_  = (void*)&fn;
+        call_ = [](void* ctx, size_t c, int w){ (*(Fn*)ctx)(c, w); };
+        for (int i=0; i<n_; ++i)
+            ranges_[i].v.store(pack(chunks*i/n_, chunks*(i+1)/n_), std::memory_order_relaxed);
+        {
+            std::lock_guard<std::mutex> lk(m_);
+            pending_ = n_ - 1;
+            ++gen_;
+        }
+        wake_.notify_all();
+        drain(0);
+        std::unique_lock<std::mutex> lk(m_);
+        done_.wait(lk, [this]{ return pending_ == 0; });
+    }
+
+private:
+    struct alignas(64) Range { std::atomic<uint64_t> v{0}; };   // begin<<32 | end
+
+    static uint64_t pack(uint64_t b, uint64_t e) { return (b << 32) | e; }
+
+    bool popFront(int w, size_t& c) {
+        uint64_t v = ranges_[w].v.load(std::memory_order_acquire);
+        for (;;) {
+            uint64_t b = v >> 32, e = v & 0xffffffffu;
+            if (b >= e) return false;
+            if (ranges_[w].v.compare_exchange_weak(v, pack(b+1, e), std::memory_order_acq_rel)) { c = b; return true; }
+        }
+    }
+    bool steal(int w, size_t& c) {
+        for (int k=1; k<n_; ++k) {
+            Range& victim = ranges_[(w + k) % n_];
+            uint64_t v = victim.v.load(std::memory_order_acquire);
+            for (;;) {
+                uint64_t b = v >> 32, e = v & 0xffffffffu;
+                if (b >= e) break;
+                uint64_t take = (e - b + 1) / 2;
+                if (victim.v.compare_exchange_weak(v, pack(b, e - take), std::memory_order_acq_rel)) {
+                    c = e - take;
+                    ranges_[w].v.store(pack(e - take + 1, e), std::memory_order_release);
+                    return true;
+                }
+            }
+        }
+        return false;
+    }
+    void drain(int w) {
+        size_t c;
+        while (popFront(w, c) || steal(w, c)) call_(ctx_, c, w);
+    }
+    void workerLoop(int w) {
+        uint64_t seen = 0;
+        for (;;) {
+            {
+                std::unique_lock<std::mutex> lk(m_);
+                wake_.wait(lk, [&]{ return gen_ != seen; });
+                seen = gen_;
+                if (quit_) return;
+            }
+            drain(w);
+            std::lock_guard<std::mutex> lk(m_);
+            if (--pending_ == 0) done_.notify_one();
+        }
+    }
+
+    int n_;
+    std::unique_ptr<Range[]> ranges_;
+    std::vector<std::thread> workers_;
+    std::mutex m_;
+    std::condition_variable wake_, done_;
+    uint64_t gen_ = 0;
+    int pending_ = 0;
+    bool quit_ = false;
+    void* ctx_ = nullptr;
+    void (*call_)(void*, size_t, int) = nullptr;
+};
+
+// ---------- simple “atmospheric” model ----------
+struct Puff {
+    float x, y;       // position
+    float r;          // radius
+    float vx, vy;     // velocity (advection/updraft)
+    float growth;     // dr/dt
+    float wobble;     // small horizontal meander
+    float life, maxLife; // seconds
+    float whiten;     // 0..1 whiteness (matures as it rises)
+};
+
+struct Emitter {
+    float x0, x1;     // horizontal source span (near ground)
+    float y;          // emission height
+    float rate;       // puffs/sec
+    float growth = 1.f, life = 1.f;   // multipliers on spawned puffs' growth rate and lifetime
+};
+
+// Cache-line aligned storage so SIMD kernels stream whole lines per column.
+template <class T, size_t Align = 64>
+struct AlignedAllocator {
+    typedef T value_type;
+    template <class U> struct rebind { typedef AlignedAllocator<U, Align> other; };
+    AlignedAllocator() = default;
+    template <class U> AlignedAllocator(const AlignedAllocator<U, Align>&) {}
+    T* allocate(size_t n) { return (T*)::operator new(n*sizeof(T), std::align_val_t(Align)); }
+    void deallocate(T* p, size_t) { ::operator delete(p, std::align_val_t(Align)); }
+    template <class U> bool operator==(const AlignedAllocator<U, Align>&) const { return true; }
+    template <class U> bool operator!=(const AlignedAllocator<U, Align>&) const { return false; }
+};
+template <class T> using AlignedVec = std::vector<T, AlignedAllocator<T>>;
+
+// What spawn does when the pool is full.
+enum OverflowPolicy { OVERFLOW_DROP_OLDEST, OVERFLOW_DROP_NEWEST, OVERFLOW_GROW };
+
+struct PoolStats {
+    uint64_t spawned = 0;
+    uint64_t droppedOldest = 0;   // live puffs overwritten by a new one
+    uint64_t droppedNewest = 0;   // spawns refused
+    uint64_t grown = 0;           // capacity doublings
+};
+
+// Read-only view of what the renderers need from a puff population.
+struct PuffView {
+    const float *x, *y, *r, *whiten;
+    size_t n;
+};
+
+// Structure-of-arrays puff store: one contiguous, 64-byte aligned column per field.
+// Doubles as a fixed-capacity pool: setBudget() reserves every column once, and
+// acquire() never reallocates unless the overflow policy is OVERFLOW_GROW.
+// Every acquired slot gets a fresh id, so a puff can be followed across steps
+// even when retirement moves it.
+struct PuffField {
+    AlignedVec<float> x, y, r, vx, vy, growth, wobble, life, maxLife, whiten;
+    AlignedVec<uint32_t> id;
+    uint32_t nextId = 0;
+    size_t budget = 0;                        // 0 → unbounded (plain vector growth)
+    OverflowPolicy overflow = OVERFLOW_DROP_OLDEST;
+    PoolStats stats;
+
+    template <class F> void forEachColumn(F f) {
+        f(x); f(y); f(r); f(vx); f(vy); f(growth); f(wobble); f(life); f(maxLife); f(whiten); f(id);
+    }
+    template <class F> void forEachColumn(F f) const {
+        f(x); f(y); f(r); f(vx); f(vy); f(growth); f(wobble); f(life); f(maxLife); f(whiten); f(id);
+    }
+    size_t size() const  { return x.size(); }
+    bool   empty() const { return x.empty(); }
+    void reserve(size_t n) { forEachColumn([n](auto& c){ c.reserve(n); }); }
+    void resize(size_t n)  { forEachColumn([n](auto& c){ c.resize(n); }); }
+    void clear()           { forEachColumn([](auto& c){ c.clear(); }); }
+    PuffView view() const  { return PuffView{ x.data(), y.data(), r.data(), whiten.data(), size() }; }
+
+    Puff get(size_t i) const {
+        return Puff{ x[i], y[i], r[i], vx[i], vy[i], growth[i], wobble[i], life[i], maxLife[i], whiten[i] };
+    }
+    void set(size_t i, const Puff& p) {
+        x[i] = p.x; y[i] = p.y; r[i] = p.r; vx[i] = p.vx; vy[i] = p.vy;
+        growth[i] = p.growth; wobble[i] = p.wobble; life[i] = p.life; maxLife[i] = p.maxLife;
+        whiten[i] = p.whiten;
+    }
+    void move(size_t dst, size_t src) {
+        forEachColumn([=](auto& c){ c[dst] = c[src]; });
+    }
+
+    void setBudget(size_t n, OverflowPolicy policy) {
+        budget = n; overflow = policy;
+        reserve(n);
+        order_.reserve(n);
+        oldest_.reserve(n);
+    }
+    // Drops the overwrite candidates, so the next full-pool spawn picks from the
+    // puffs as they are now. The simulation calls this every step, which keeps a
+    // restored run choosing exactly as the uninterrupted one.
+    void forgetOldest() { oldest_.clear(); batch_ = kFirstBatch; }
+
+    // Slot for a new puff, or -1 if the pool is full and drops new spawns.
+    long acquire() {
+        size_t n = size();
+        if (budget && n >= budget) {
+            if (overflow == OVERFLOW_DROP_NEWEST) { ++stats.droppedNewest; return -1; }
+            if (overflow == OVERFLOW_DROP_OLDEST) {
+                const size_t oldest = takeOldest();
+                ++stats.droppedOldest; ++stats.spawned;
+                id[oldest] = nextId++;
+                return (long)oldest;
+            }
+            budget *= 2; reserve(budget);
+            ++stats.grown;
+        }
+        resize(n+1);
+        ++stats.spawned;
+        id[n] = nextId++;
+        return (long)n;
+    }
+
+private:
+    // Overwrite candidates: the oldest puffs' slots, oldest last, each with the
+    // id it held when chosen. Every puff ages at the same rate, so the order
+    // holds while candidates wait. A slot that has since been retired, moved
+    // or reused no longer carries its id and is skipped. One pass over the
+    // pool, keeping the batch_ oldest in a heap, refills the candidates, and
+    // each refill within a step doubles the batch. A full pool therefore costs
+    // about one scan per step, plus a few more only when a step spawns more
+    // than 64 puffs, instead of a scan per spawn.
+    enum { kFirstBatch = 64 };
+    std::vector<std::pair<uint32_t, uint32_t>> oldest_;   // (slot, id)
+    std::vector<uint32_t> order_;                          // heap scratch
+    size_t batch_ = kFirstBatch;
+
+    size_t takeOldest() {
+        for (;;) {
+            while (!oldest_.empty()) {
+                const std::pair<uint32_t, uint32_t> c = oldest_.back();
+                oldest_.pop_back();
+                if (c.first < size() && id[c.first] == c.second) return c.first;
+            }
+            refillOldest();
+        }
+    }
+    void refillOldest() {
+        const size_t n = size(), k = std::min(n, batch_);
+        batch_ *= 2;
+        // Ties go to the lower slot, as a first-to-last scan for the maximum would.
+        auto older = [this](uint32_t a, uint32_t b) { return life[a] > life[b] || (life[a] == life[b] && a < b); };
+        order_.clear();                    // heap with the youngest kept puff on top
+        for (uint32_t i=0; i<(uint32_t)n; ++i) {
+            if (order_.size() < k) { order_.push_back(i); std::push_heap(order_.begin(), order_.end(), older); }
+            else if (older(i, order_.front())) {
+                std::pop_heap(order_.begin(), order_.end(), older);
+                order_.back() = i;
+                std::push_heap(order_.begin(), order_.end(), older);
+            }
+        }
+        std::sort_heap(order_.begin(), order_.end(), older);   // oldest first
+        for (size_t j=order_.size(); j-- > 0; ) oldest_.emplace_back(order_[j], id[order_[j]]);
+    }
+};
+
+// Spawn count puffs from E. Random draws come in blocks, one contiguous run per
+// field, so the transforms below are straight-line loops the compiler vectorizes.
+// Returns how many puffs got a slot.
+static int spawnPuffs(PuffField& P, const Emitter& E, int count, Rng& rng) {
+    enum { kBlock = 64, kFields = 8 };
+    float u[kFields][kBlock];
+    int placed = 0;
+    for (int done = 0; done < count; done += kBlock) {
+        const int n = std::min((int)kBlock, count - done);
+        for (int f=0; f<kFields; ++f) rng.fill(u[f], (size_t)n);
+        for (int j=0; j<n; ++j) u[0][j] = E.x0 + u[0][j]*(E.x1 - E.x0);
+        for (int j=0; j<n; ++j) u[1][j] = E.y + u[1][j]*10.f;
+        for (int j=0; j<n; ++j) u[2][j] = 12.f + u[2][j]*10.f;
+        for (int j=0; j<n; ++j) u[3][j] = (u[3][j]-0.5f)*8.f;        // gentle breeze
+        for (int j=0; j<n; ++j) u[4][j] = 12.f + u[4][j]*10.f;       // updraft
+        for (int j=0; j<n; ++j) u[5][j] = (3.f + u[5][j]*6.f) * E.growth;   // grows as condenses
+        for (int j=0; j<n; ++j) u[6][j] = (u[6][j]*2.f - 1.f) * 0.8f;
+        for (int j=0; j<n; ++j) u[7][j] = (18.f + u[7][j]*8.f) * E.life;
+        for (int j=0; j<n; ++j) {
+            long slot = P.acquire();
+            if (slot < 0) continue;
+            P.set((size_t)slot, Puff{ u[0][j], u[1][j], u[2][j], u[3][j], u[4][j],
+                                      u[5][j], u[6][j], 0.f, u[7][j], 0.2f });
+            ++placed;
+        }
+    }
+    return placed;
+}
+
+// Read-only view of a gridded wind (see WindField) for the update kernel.
+// u == nullptr: no grid; puffs ease toward the uniform breeze and rise at a
+// fixed, height-dependent rate.
+struct WindView {
+    const float* u = nullptr;
+    const float* v = nullptr;
+    int nx = 0, ny = 0;
+    float invW = 0.f, invH = 0.f;   // cells per px
+};
+
+struct StepParams {
+    float dt, breeze;
+    float winW, winH;
+    WindView wind;
+};
+
+// Bilinear gather of the wind at puff positions. Cell centers sit at half-cell
+// offsets. Positions clamp to the outermost centers, so puffs in the wrap margin
+// see the edge wind.
+template <class V>
+static inline void sampleWind(const WindView& W, typename V::T x, typename V::T y,
+                              typename V::T& u, typename V::T& v) {
+    typedef typename V::T T;
+    const T half = V::set1(0.5f), zero = V::set1(0.f);
+    T gx = V::max(zero, V::min(V::set1((float)(W.nx - 1)), V::sub(V::mul(x, V::set1(W.invW)), half)));
+    T gy = V::max(zero, V::min(V::set1((float)(W.ny - 1)), V::sub(V::mul(y, V::set1(W.invH)), half)));
+    T x0 = V::min(V::set1((float)(W.nx - 2)), V::floor(gx)), y0 = V::min(V::set1((float)(W.ny - 2)), V::floor(gy));
+    T fx = V::sub(gx, x0), fy = V::sub(gy, y0);
+    typename V::I k = V::index(V::add(V::mul(y0, V::set1((float)W.nx)), x0));
+    auto lerp2 = [&](const float* p) {
+        T a = V::gather(p, k), b = V::gather(p + 1, k);
+        T c = V::gather(p + W.nx, k), d = V::gather(p + W.nx + 1, k);
+        T lo = V::add(a, V::mul(fx, V::sub(b, a)));
+        T hi = V::add(c, V::mul(fx, V::sub(d, c)));
+        return V::add(lo, V::mul(fy, V::sub(hi, lo)));
+    };
+    u = lerp2(W.u);
+    v = lerp2(W.v);
+}
+
+// Integrate puffs [i, end) in steps of V::N lanes and append the indices of puffs
+// that died this step (too old or risen off the top) to dead. Returns where it stopped.
+template <class V>
+static size_t integrateSpan(PuffField& P, size_t i, size_t end, const StepParams& sp,
+                            std::vector<uint32_t>& dead) {
+    typedef typename V::T T;
+    const T dt = V::set1(sp.dt), breeze = V::set1(sp.breeze), H = V::set1(sp.winH);
+    const T zero = V::set1(0.f), one = V::set1(1.f), ceiling = V::set1(sp.winH*1.1f);
+    const T wrapLo = V::set1(-100.f), wrapHi = V::set1(sp.winW + 100.f), span = V::set1(sp.winW + 200.f);
+    for (; i + V::N <= end; i += V::N) {
+        T life = V::add(V::load(&P.life[i]), dt);
+        // Updraft weakens with height; breeze blows right
+        T hn = V::max(zero, V::min(one, V::div(V::load(&P.y[i]), H)));
+        T vx = V::load(&P.vx[i]), vy, wind = breeze;
+        if (sp.wind.u) {
+            // Carried by the local wind, plus the puff's own gentle rise
+            sampleWind<V>(sp.wind, V::load(&P.x[i]), V::load(&P.y[i]), wind, vy);
+            vy = V::add(vy, V::set1(8.f));
+        } else {
+            T up = V::sub(one, V::mul(V::set1(0.4f), hn));
+            vy = V::add(V::mul(V::set1(10.f), up), V::set1(8.f));             // keep rising gently
+        }
+        vx = V::add(vx, V::mul(V::sub(wind, vx), V::set1(0.05f)));            // ease toward the wind
+        T wob = V::mul(V::load(&P.wobble[i]), fastSin<V>(V::mul(V::set1(2.f), life)));
+        T x = V::add(V::load(&P.x[i]), V::mul(V::add(vx, wob), dt));
+        T y = V::add(V::load(&P.y[i]), V::mul(vy, dt));
+        T rate = V::add(V::set1(0.6f), V::mul(V::set1(0.4f), V::sub(one, hn)));
+        T r = V::add(V::load(&P.r[i]), V::mul(V::mul(V::load(&P.growth[i]), dt), rate));
+        T w = V::add(V::load(&P.whiten[i]), V::mul(dt, V::set1(0.15f)));
+        w = V::max(zero, V::min(one, w));
+        // confine horizontally (wrap)
+        x = V::select(V::lt(x, wrapLo), V::add(x, span), x);
+        x = V::select(V::gt(x, wrapHi), V::sub(x, span), x);
+        V::store(&P.life[i], life); V::store(&P.vy[i], vy); V::store(&P.vx[i], vx);
+        V::store(&P.x[i], x); V::store(&P.y[i], y); V::store(&P.r[i], r); V::store(&P.whiten[i], w);
+        // old/high puffs retire
+        int m = V::bits(V::orm(V::gt(life, V::load(&P.maxLife[i])), V::gt(V::sub(y, r), ceiling)));
+        for (; m; m &= m-1) dead.push_back((uint32_t)(i + __builtin_ctz((unsigned)m)));
+    }
+    return i;
+}
+
+static void integratePuffs(PuffField& P, size_t begin, size_t end, const StepParams& sp,
+                           std::vector<uint32_t>& dead) {
+    size_t i = integrateSpan<SimdF>(P, begin, end, sp, dead);
+    integrateSpan<ScalarF>(P, i, end, sp, dead);
+}
+
+// How dead puffs leave the field. STABLE keeps draw order (survivors after the
+// first dead puff all shift down); SWAP fills each hole with the last puff, so
+// only dead slots are touched but back-to-front blend order changes cosmetically.
+enum RetireMode { RETIRE_STABLE, RETIRE_SWAP };
+
+// dead must be ascending, as integratePuffs produces it.
+static void retirePuffs(PuffField& P, const std::vector<uint32_t>& dead, RetireMode mode) {
+    if (dead.empty()) return;
+    size_t n = P.size();
+    if (mode == RETIRE_SWAP) {
+        // Back to front: once every higher dead slot is gone, the last puff is alive.
+        for (size_t k = dead.size(); k-- > 0; ) {
+            --n;
+            if (dead[k] != n) P.move(dead[k], n);
+        }
+    } else {
+        size_t keep = dead[0], k = 0;
+        for (size_t i = dead[0]; i < n; ++i) {
+            if (k < dead.size() && dead[k] == i) { ++k; continue; }
+            P.move(keep++, i);
+        }
+        n = keep;
+    }
+    P.resize(n);
+}
+
+// Puffs per parallel chunk. A multiple of 16 floats, so every chunk starts on its
+// own 64-byte line in every column and workers never share a line.
+static const size_t kPuffChunk = 4096;
+
+// Caller-owned scratch so steady-state steps don't allocate.
+struct UpdateScratch {
+    std::vector<uint32_t> dead;
+    std::vector<std::vector<uint32_t>> chunkDead;   // per chunk; joined in chunk order
+};
+
+// With a pool, chunks are integrated in parallel and their dead lists joined in
+// chunk order, so the result is bit-identical for any thread count.
+static void updatePuffs(PuffField& P, const StepParams& sp, RetireMode mode,
+                        UpdateScratch& S, TaskPool* pool = nullptr) {
+    std::vector<uint32_t>& dead = S.dead;
+    if (dead.capacity() < P.budget) dead.reserve(P.budget);
+    dead.clear();
+    const size_t n = P.size();
+    if (!pool || pool->size() == 1 || n < 2*kPuffChunk) {
+        integratePuffs(P, 0, n, sp, dead);
+    } else {
+        const size_t chunks = (n + kPuffChunk - 1) / kPuffChunk;
+        if (S.chunkDead.size() < chunks) S.chunkDead.resize(chunks);
+        pool->parallelFor(chunks, [&](size_t c, int) {
+            std::vector<uint32_t>& cd = S.chunkDead[c];
+            cd.clear();
+            integratePuffs(P, c*kPuffChunk, std::min(n, (c+1)*kPuffChunk), sp, cd);
+        });
+        for (size_t c=0; c<chunks; ++c) dead.insert(dead.end(), S.chunkDead[c].begin(), S.chunkDead[c].end());
+    }
+    retirePuffs(P, dead, mode);
+}
+
+// ---------- spatial grid ----------
+// Uniform cell list over puff centers, rebuilt from scratch every step by a
+// stable counting sort on cell index: per-chunk histograms, one prefix sum in
+// (cell, chunk) order, then a parallel scatter, so the result does not depend on
+// the thread count. reorder() then permutes every puff column into cell order.
+// Neighbours become adjacent in memory, and cell c holds slots
+// [cellStart[c], cellStart[c+1]). Positions outside the domain clamp into the
+// border cells. Clamping never moves two points further apart, so radius
+// queries stay exact.
+static const size_t kGridChunk = 65536;
+
+struct PuffGrid {
+    float cell = 64.f, inv = 1.f/64.f;
+    int nx = 0, ny = 0;
+    AlignedVec<uint32_t> cellOf;      // per puff, in the order build() saw them
+    AlignedVec<uint32_t> cellStart;   // nx*ny + 1 prefix sums
+    AlignedVec<uint32_t> order;       // sorted position → slot at build time
+    AlignedVec<float>    cellMaxR;    // largest puff radius per cell (0 when empty)
+    float maxR = 0.f;                 // largest radius anywhere
+    std::vector<uint32_t> chunkCount; // chunks × cells, cell-major after the prefix sum
+    std::vector<float>    chunkMaxR;  // chunks × cells
+    AlignedVec<float>    tmpF;        // reorder scratch, one per column type
+    AlignedVec<uint32_t> tmpU;
+
+    size_t cells() const { return (size_t)nx*ny; }
+
+    int cellX(float x) const { return (int)clampf(x*inv, 0.f, (float)(nx-1)); }
+    int cellY(float y) const { return (int)clampf(y*inv, 0.f, (float)(ny-1)); }
+
+    void build(const PuffField& P, float cellSize, int winW, int winH, TaskPool* pool = nullptr) {
+        cell = cellSize; inv = 1.f/cellSize;
+        nx = std::max(1, (int)std::ceil(winW*inv));
+        ny = std::max(1, (int)std::ceil(winH*inv));
+        const size_t n = P.size(), C = cells();
+        const size_t chunks = std::max<size_t>(1, (n + kGridChunk - 1) / kGridChunk);
+        cellOf.resize(n);
+        order.resize(n);
+        cellStart.assign(C + 1, 0);
+        chunkCount.assign(chunks*C, 0);
+        chunkMaxR.assign(chunks*C, 0.f);
+        cellMaxR.resize(C);
+        auto run = [&](auto&& fn) {
+            if (pool && pool->size() > 1 && chunks > 1) pool->parallelFor(chunks, fn);
+            else for (size_t c=0; c<chunks; ++c) fn(c, 0);
+        };
+        run([&](size_t c, int) {
+            uint32_t* count = &chunkCount[c*C];
+            float* big = &chunkMaxR[c*C];
+            for (size_t i=c*kGridChunk, e=std::min(n, i+kGridChunk); i<e; ++i) {
+                uint32_t k = (uint32_t)(cellY(P.y[i])*nx + cellX(P.x[i]));
+                cellOf[i] = k;
+                ++count[k];
+                big[k] = std::max(big[k], P.r[i]);
+            }
+        });
+        uint32_t sum = 0;
+        maxR = 0.f;
+        for (size_t k=0; k<C; ++k) {
+            cellStart[k] = sum;
+            float big = 0.f;
+            for (size_t c=0; c<chunks; ++c) {
+                uint32_t v = chunkCount[c*C + k];
+                chunkCount[c*C + k] = sum;
+                sum += v;
+                big = std::max(big, chunkMaxR[c*C + k]);
+            }
+            cellMaxR[k] = big;
+            maxR = std::max(maxR, big);
+        }
+        cellStart[C] = sum;
+        run([&](size_t c, int) {
+            uint32_t* next = &chunkCount[c*C];
+            for (size_t i=c*kGridChunk, e=std::min(n, i+kGridChunk); i<e; ++i)
+                order[next[cellOf[i]]++] = (uint32_t)i;
+        });
+    }
+
+    // Permute the puffs into cell order; afterwards slot i lies in the cell that
+    // cellStart ranges describe. Scratch keeps the columns' capacity, so the pool
+    // budget reserved up front still holds.
+    void reorder(PuffField& P, TaskPool* pool = nullptr) {
+        const size_t n = order.size();
+        auto gather = [&](auto& col, auto& tmp) {
+            if (tmp.capacity() < col.capacity()) tmp.reserve(col.capacity());
+            tmp.resize(n);
+            auto body = [&](size_t c, int) {
+                for (size_t i=c*kGridChunk, e=std::min(n, i+kGridChunk); i<e; ++i) tmp[i] = col[order[i]];
+            };
+            const size_t chunks = (n + kGridChunk - 1) / kGridChunk;
+            if (pool && pool->size() > 1 && chunks > 1) pool->parallelFor(chunks, body);
+            else for (size_t c=0; c<chunks; ++c) body(c, 0);
+            col.swap(tmp);
+        };
+        P.forEachColumn([&](auto& col) { gather(col, scratchFor(col)); });
+    }
+    AlignedVec<float>&    scratchFor(const AlignedVec<float>&)    { return tmpF; }
+    AlignedVec<uint32_t>& scratchFor(const AlignedVec<uint32_t>&) { return tmpU; }
+
+    // Calls f(slot) for every puff in the cells overlapping the square of half-size
+    // `reach` around (x, y). Slots refer to the reordered field.
+    template <class F> void forNear(float x, float y, float reach, F f) const {
+        const int x0 = cellX(x - reach), x1 = cellX(x + reach);
+        const int y0 = cellY(y - reach), y1 = cellY(y + reach);
+        for (int cy = y0; cy <= y1; ++cy)
+            for (uint32_t i = cellStart[(size_t)cy*nx + x0]; i < cellStart[(size_t)cy*nx + x1 + 1]; ++i) f(i);
+    }
+
+    // Calls f(slot) for every puff whose center may lie closer to (x, y) than
+    // k*(r + its own radius). The window is sized for the largest puff anywhere,
+    // but a cell is only entered when its own largest puff could reach, so one
+    // big puff does not widen every query. Windows of up to 3×3 cells, and rows
+    // holding fewer puffs than the window has cells, are scanned whole, which is
+    // cheaper than testing cells. Either way f sees slots in the same ascending
+    // order. Radii are as of build().
+    template <class F> void forReach(float x, float y, float r, float k, F f) const {
+        const float reach = k*(r + maxR);
+        const int x0 = cellX(x - reach), x1 = cellX(x + reach);
+        const int y0 = cellY(y - reach), y1 = cellY(y + reach);
+        if (x1 - x0 <= 2 && y1 - y0 <= 2) { forNear(x, y, reach, f); return; }
+        // Clamping the point into the domain stands in for the open border cells;
+        // it can only shrink a gap, so no reachable cell is skipped.
+        const float px = clampf(x, 0.f, nx*cell), py = clampf(y, 0.f, ny*cell);
+        auto gap = [this](float v, int c) { return std::max(0.f, std::max(c*cell - v, v - (c + 1)*cell)); };
+        for (int cy = y0; cy <= y1; ++cy) {
+            const size_t row = (size_t)cy*nx;
+            const uint32_t lo = cellStart[row + x0], hi = cellStart[row + x1 + 1];
+            const bool whole = hi - lo <= (uint32_t)(x1 - x0 + 1);
+            const float gy = gap(py, cy), gy2 = gy*gy;
+            // [a, b) is the pending run of slots; f is called from one place only.
+            uint32_t a = lo, b = whole ? hi : lo;
+            for (int cx = whole ? x1 + 1 : x0; ; ++cx) {
+                uint32_t s = 0, e = 0;
+                if (cx <= x1) {
+                    const size_t c = row + cx;
+                    s = cellStart[c]; e = cellStart[c+1];
+                    if (s == e) continue;
+                    const float gx = gap(px, cx), lim = k*(r + cellMaxR[c]);
+                    if (gx*gx + gy2 >= lim*lim) continue;
+                    if (s == b) { b = e; continue; }
+                }
+                for (uint32_t i = a; i < b; ++i) f(i);
+                if (cx > x1) break;
+                a = s; b = e;
+            }
+        }
+    }
+};
+
+// ---------- coalescence ----------
+// Runs after the grid has put the puffs in cell order. Two overlapping puffs that
+// are big and white enough merge into one. The merge conserves area (r² adds),
+// and momentum with mass taken as area; the other fields are area-weighted and
+// the larger puff keeps its id. Each puff merges at most once per step. Pairs
+// are found by scanning slots in order and taking each puff's nearest later
+// partner; the criteria are symmetric, so a puff left alone had no valid partner
+// earlier either. Each query only enters cells whose largest puff could reach,
+// so the pass stays O(N) and deterministic. Absorbed puffs
+// leave through retirePuffs. Optionally, puffs over splitRadius split into two
+// halves of equal area that drift apart with equal and opposite kicks. A split
+// never evicts another puff from a full pool, and no merge may produce a puff
+// that would split again straight away.
+struct MergeParams {
+    bool  merge = true;        // false: only the split pass runs
+    float minRadius = 36.f;    // r_i + r_j must reach this
+    float minWhiten = 0.6f;    // and their area-weighted whiten this
+    float overlap = 0.35f;     // centers closer than overlap*(r_i + r_j)
+    float splitRadius = 0.f;   // > 0: puffs larger than this split in two
+    float splitKick = 4.f;     // px/s given to each half, in opposite directions
+};
+struct MergeStats { uint64_t merges = 0, splits = 0; };
+struct MergeScratch {
+    std::vector<uint32_t> dead;
+    std::vector<uint8_t>  taken;
+};
+
+static void coalescePuffs(PuffField& P, const PuffGrid& G, const MergeParams& mp, RetireMode mode,
+                          MergeScratch& S, Rng& rng, MergeStats& stats) {
+    const size_t n = P.size();
+    if (mp.merge && n >= 2) {
+        S.taken.assign(n, 0);
+        S.dead.clear();
+        for (size_t i=0; i<n; ++i) {
+            if (S.taken[i]) continue;
+            const float xi = P.x[i], yi = P.y[i], ri = P.r[i], ai = ri*ri;
+            long best = -1;
+            float bestD2 = 0.f;
+            G.forReach(xi, yi, ri, mp.overlap, [&](uint32_t j) {
+                if (j <= i || S.taken[j]) return;
+                const float rj = P.r[j], aj = rj*rj;
+                if (ri + rj < mp.minRadius) return;
+                if (mp.splitRadius > 0.f && ai + aj > mp.splitRadius*mp.splitRadius) return;   // would split again
+                if (ai*P.whiten[i] + aj*P.whiten[j] < mp.minWhiten*(ai + aj)) return;
+                const float dx = P.x[j] - xi, dy = P.y[j] - yi, d2 = dx*dx + dy*dy;
+                const float reach = mp.overlap*(ri + rj);
+                if (d2 < reach*reach && (best < 0 || d2 < bestD2)) { best = j; bestD2 = d2; }
+            });
+            if (best < 0) continue;
+            const size_t j = (size_t)best;
+            const float aj = P.r[j]*P.r[j], wi = ai/(ai + aj), wj = 1.f - wi;
+            auto mix = [&](AlignedVec<float>& c) { c[i] = wi*c[i] + wj*c[j]; };
+            mix(P.x); mix(P.y); mix(P.vx); mix(P.vy); mix(P.growth); mix(P.life); mix(P.maxLife); mix(P.whiten);
+            if (aj > ai) { P.wobble[i] = P.wobble[j]; P.id[i] = P.id[j]; }
+            P.r[i] = std::sqrt(ai + aj);
+            S.taken[i] = S.taken[j] = 1;
+            S.dead.push_back((uint32_t)j);
+            ++stats.merges;
+        }
+        std::sort(S.dead.begin(), S.dead.end());
+        retirePuffs(P, S.dead, mode);
+    }
+
+    if (mp.splitRadius > 0.f) {
+        const size_t m = P.size();
+        for (size_t i=0; i<m; ++i) {
+            if (P.r[i] <= mp.splitRadius) continue;
+            if (P.budget && P.size() >= P.budget && P.overflow != OVERFLOW_GROW) break;
+            const long k = P.acquire();
+            if (k < 0) break;
+            const float ang = rng.uniform() * 2.f*(float)M_PI;
+            const float ux = std::cos(ang), uy = std::sin(ang);
+            // Far enough apart that the halves do not qualify to re-merge at once.
+            const float r = P.r[i] * (float)M_SQRT1_2, d = 1.1f*mp.overlap*r;
+            const uint32_t id = P.id[(size_t)k];
+            P.forEachColumn([&](auto& c) { c[(size_t)k] = c[i]; });
+            P.id[(size_t)k] = id;
+            P.r[i] = P.r[(size_t)k] = r;
+            P.x[i] -= ux*d;  P.x[(size_t)k] += ux*d;
+            P.y[i] -= uy*d;  P.y[(size_t)k] += uy*d;
+            P.vx[i] -= ux*mp.splitKick;  P.vx[(size_t)k] += ux*mp.splitKick;
+            P.vy[i] -= uy*mp.splitKick;  P.vy[(size_t)k] += uy*mp.splitKick;
+            ++stats.splits;
+        }
+    }
+}
+
+// ---------- multigrid poisson ----------
+// Geometric multigrid for ∇²p = f on a cell-centered nx×ny grid with spacing
+// (dx, dy). Boundaries: p = 0 on the left and right faces (open sides), and
+// ∂p/∂n = 0 at the bottom and top (ground and lid). Coarse levels halve the
+// grid while both sides are even and at least 4, and rediscretize the same
+// operator at twice the spacing; multigridRound() picks sizes that go deep. Each V-cycle applies pre-smoothing, restricts
+// the residual by 2×2 averaging, recurses, prolongs the correction bilinearly,
+// then post-smooths. The coarsest level just gets many sweeps. The smoother is
+// red-black Gauss-Seidel. Every lane of a row is computed, and a parity mask
+// keeps only the current color. Cells of one color read only the other color,
+// so row blocks run on the TaskPool, and the result does not depend on the
+// thread count. The solution is kept between solves as a warm start.
+static const int kMgRows = 16;             // rows per parallel block
+static const size_t kMgParallel = 131072;  // cells below which a level runs serially
+
+class MultigridPoisson {
+public:
+    int preSmooth = 2, postSmooth = 2;
+    int maxCycles = 10;
+    float tolerance = 1e-3f;                 // on ‖f - ∇²p‖ / ‖f‖
+
+    void init(int nx, int ny, float dx, float dy) {
+        L_.clear();
+        float ax = 1.f/(dx*dx), ay = 1.f/(dy*dy);
+        for (;;) {
+            L_.emplace_back();
+            Level& l = L_.back();
+            l.nx = nx; l.ny = ny; l.ax = ax; l.ay = ay;
+            for (AlignedVec<float>* f : { &l.p, &l.f, &l.r }) f->assign((size_t)nx*ny, 0.f);
+            l.zero.assign((size_t)nx, 0.f);
+            if (nx % 2 || ny % 2 || nx < 4 || ny < 4) break;
+            nx /= 2; ny /= 2; ax *= 0.25f; ay *= 0.25f;
+        }
+    }
+
+    int levels() const { return (int)L_.size(); }
+    void reset() { std::fill(L_[0].p.begin(), L_[0].p.end(), 0.f); }   // drop the warm start
+    AlignedVec<float>& rhs() { return L_[0].f; }
+    AlignedVec<float>& solution() { return L_[0].p; }
+    const AlignedVec<float>& solution() const { return L_[0].p; }
+
+    // V-cycles until the relative residual drops below tolerance. Returns the
+    // cycles run (0 if the warm start already converged) and the final residual.
+    int solve(TaskPool* pool, float& residual) {
+        Level& l = L_[0];
+        double fn = 0.0;
+        for (float v : l.f) fn += (double)v*v;
+        if (fn == 0.0) { std::fill(l.p.begin(), l.p.end(), 0.f); residual = 0.f; return 0; }
+        fn = std::sqrt(fn);
+        residual = (float)(computeResidual(l, pool) / fn);
+        int cycles = 0;
+        while (residual > tolerance && cycles < maxCycles) {
+            vcycle(0, pool);
+            ++cycles;
+            residual = (float)(computeResidual(l, pool) / fn);
+        }
+        return cycles;
+    }
+
+private:
+    struct Level {
+        int nx = 0, ny = 0;
+        float ax = 1.f, ay = 1.f;            // 1/dx², 1/dy²
+        AlignedVec<float> p, f, r;
+        AlignedVec<float> zero;              // stands in for the row beyond a Neumann face
+    };
+    std::vector<Level> L_;
+    std::vector<double> blockSums_;
+
+    // fn(j0, j1) over blocks of kMgRows rows; threaded on large levels.
+    template <class F>
+    void forRows(const Level& l, TaskPool* pool, F&& fn) {
+        const size_t blocks = (size_t)(l.ny + kMgRows - 1) / kMgRows;
+        auto block = [&](size_t b, int) { fn((int)b*kMgRows, std::min(l.ny, (int)(b+1)*kMgRows)); };
+        if (pool && pool->size() > 1 && (size_t)l.nx*l.ny >= kMgParallel) pool->parallelFor(blocks, block);
+        else for (size_t b=0; b<blocks; ++b) block(b, 0);
+    }
+
+    // Neighbour rows and the diagonal for row j. A missing row is the zero row,
+    // with its coupling moved into the diagonal (Neumann).
+    void rowStencil(const Level& l, const float* p, int j, const float*& dn, const float*& up, float& diag) const {
+        dn = j > 0 ? p + (size_t)(j-1)*l.nx : l.zero.data();
+        up = j + 1 < l.ny ? p + (size_t)(j+1)*l.nx : l.zero.data();
+        diag = 2.f*l.ax + l.ay*((j > 0) + (j + 1 < l.ny));
+    }
+
+    // One color of row j over [i, end) in V::N lanes; returns where it stopped.
+    // The row is written to the residual buffer, which is free while smoothing,
+    // and copied back afterwards. Storing in place would make the next load of
+    // c + i - 1 straddle the store just made and stall store forwarding.
+    // Edge columns see a ghost of -p (Dirichlet), which adds ax to the diagonal.
+    template <class V>
+    int sweepRow(Level& l, int j, int color, int i, int end) {
+        typedef typename V::T T;
+        static const float kAlt[17] = { 1,0,1,0,1,0,1,0,1,0,1,0,1,0,1,0,1 };
+        const float* c = &l.p[(size_t)j*l.nx];
+        float* out = &l.r[(size_t)j*l.nx];
+        const float* f = &l.f[(size_t)j*l.nx];
+        const float *dn, *up; float diag;
+        rowStencil(l, l.p.data(), j, dn, up, diag);
+        const T ax = V::set1(l.ax), ay = V::set1(l.ay), inv = V::set1(1.f/diag), half = V::set1(0.5f);
+        for (; i + V::N <= end; i += V::N) {
+            T s = V::add(V::mul(ax, V::add(V::load(c + i - 1), V::load(c + i + 1))),
+                         V::mul(ay, V::add(V::load(dn + i), V::load(up + i))));
+            T pn = V::mul(V::sub(s, V::load(f + i)), inv);
+            typename V::M m = V::gt(V::load(kAlt + ((i + j + color) & 1)), half);   // lanes of this color
+            V::store(out + i, V::select(m, pn, V::load(c + i)));
+        }
+        return i;
+    }
+
+    void sweepEdge(Level& l, int j, int i) {
+        float* c = &l.p[(size_t)j*l.nx];
+        const float *dn, *up; float diag;
+        rowStencil(l, l.p.data(), j, dn, up, diag);
+        float s = l.ay*(dn[i] + up[i]);
+        if (i > 0) s += l.ax*c[i-1];
+        if (i + 1 < l.nx) s += l.ax*c[i+1];
+        diag += l.ax*((i == 0) + (i + 1 == l.nx));
+        c[i] = (s - l.f[(size_t)j*l.nx + i]) / diag;
+    }
+
+    void smooth(Level& l, int sweeps, TaskPool* pool) {
+        for (int s=0; s<sweeps; ++s)
+            for (int color=0; color<2; ++color)
+                forRows(l, pool, [&](int j0, int j1) {
+                    for (int j=j0; j<j1; ++j) {
+                        if ((j + color) % 2 == 0) sweepEdge(l, j, 0);
+                        if ((l.nx - 1 + j + color) % 2 == 0) sweepEdge(l, j, l.nx - 1);
+                        int i = sweepRow<SimdF>(l, j, color, 1, l.nx - 1);
+                        sweepRow<ScalarF>(l, j, color, i, l.nx - 1);
+                        // Copy back this color only; the other is being read by neighbouring rows.
+                        float* c = &l.p[(size_t)j*l.nx];
+                        const float* out = &l.r[(size_t)j*l.nx];
+                        for (i = 2 - (j + color) % 2; i < l.nx - 1; i += 2) c[i] = out[i];
+                    }
+                });
+    }
+
+    // r = f - ∇²p; returns ‖r‖₂, summed per block in block order.
+    double computeResidual(Level& l, TaskPool* pool) {
+        const size_t blocks = (size_t)(l.ny + kMgRows - 1) / kMgRows;
+        blockSums_.assign(blocks, 0.0);
+        forRows(l, pool, [&](int j0, int j1) {
+            double sum = 0.0;
+            for (int j=j0; j<j1; ++j) {
+                const float* c = &l.p[(size_t)j*l.nx];
+                const float* f = &l.f[(size_t)j*l.nx];
+                float* r = &l.r[(size_t)j*l.nx];
+                const float *dn, *up; float diag;
+                rowStencil(l, l.p.data(), j, dn, up, diag);
+                auto cell = [&](int i, float left, float right) {
+                    r[i] = f[i] - (l.ax*(left + right) + l.ay*(dn[i] + up[i]) - diag*c[i]);
+                };
+                cell(0, -c[0], c[1]);
+                for (int i=1; i<l.nx-1; ++i) cell(i, c[i-1], c[i+1]);
+                cell(l.nx-1, c[l.nx-2], -c[l.nx-1]);
+                float part[8] = { 0.f };             // eight running sums, so the loop vectorizes
+                int i = 0;
+                for (; i + 8 <= l.nx; i += 8)
+                    for (int k=0; k<8; ++k) part[k] += r[i+k]*r[i+k];
+                for (; i < l.nx; ++i) part[0] += r[i]*r[i];
+                for (float v : part) sum += v;
+            }
+            blockSums_[(size_t)j0 / kMgRows] = sum;
+        });
+        double sum = 0.0;
+        for (double s : blockSums_) sum += s;
+        return std::sqrt(sum);
+    }
+
+    void vcycle(size_t k, TaskPool* pool) {
+        Level& l = L_[k];
+        if (k + 1 == L_.size()) { smooth(l, 2*(l.nx + l.ny), pool); return; }
+        Level& c = L_[k + 1];
+        smooth(l, preSmooth, pool);
+        computeResidual(l, pool);
+        forRows(c, pool, [&](int j0, int j1) {
+            for (int j=j0; j<j1; ++j)
+                for (int i=0; i<c.nx; ++i) {
+                    const float* r = &l.r[(size_t)(2*j)*l.nx + 2*i];
+                    c.f[(size_t)j*c.nx + i] = 0.25f*(r[0] + r[1] + r[l.nx] + r[l.nx + 1]);
+                    c.p[(size_t)j*c.nx + i] = 0.f;
+                }
+        });
+        vcycle(k + 1, pool);
+        // Bilinear between coarse centers: 9/16 parent, 3/16 each side, 1/16 corner.
+        forRows(l, pool, [&](int j0, int j1) {
+            for (int j=j0; j<j1; ++j) {
+                const int J = j/2, J2 = std::max(0, std::min(c.ny - 1, J + (j % 2 ? 1 : -1)));
+                const float* e = &c.p[(size_t)J*c.nx];
+                const float* e2 = &c.p[(size_t)J2*c.nx];
+                for (int i=0; i<l.nx; ++i) {
+                    const int I = i/2, I2 = std::max(0, std::min(c.nx - 1, I + (i % 2 ? 1 : -1)));
+                    l.p[(size_t)j*l.nx + i] += 0.5625f*e[I] + 0.1875f*(e[I2] + e2[I]) + 0.0625f*e2[I2];
+                }
+            }
+        });
+        smooth(l, postSmooth, pool);
+    }
+};
+
+// Rounds a grid up so that it halves cleanly until the longer side is at most
+// 16 cells (or the shorter one would drop below 2). An odd side would otherwise
+// stop the coarsening at the fine level. Each side grows by less than an eighth
+// of the longer one. Returns whether anything changed.
+static bool multigridRound(int& nx, int& ny) {
+    int step = 1;
+    while ((std::max(nx, ny) + step - 1) / step > 16 && (std::min(nx, ny) + 2*step - 1) / (2*step) >= 2) step *= 2;
+    const int rx = (nx + step - 1) / step * step, ry = (ny + step - 1) / step * step;
+    const bool changed = rx != nx || ry != ny;
+    nx = rx; ny = ry;
+    return changed;
+}
+
+// ---------- wind field ----------
+// Gridded wind shared by the puffs and the atmosphere grid (particle-in-cell
+// coupling). The base flow is kinematic. The breeze is sheared with height, so
+// it is slower near the ground and faster aloft. A Gaussian thermal rises over
+// each emitter, and weak subsidence sinks everywhere else. On top of that rides
+// an updraft w driven by the puffs: deposit() scatters each puff's condensed
+// area onto its four nearest cells as cloud cover, and step() turns cover
+// (capped at 1) into upward acceleration that decays back to the base flow. The update kernel
+// gathers (u, v) bilinearly at each puff, so per-puff cost does not depend on
+// the grid size.
+//
+// project() makes (u, v) divergence-free with a multigrid pressure solve. Air
+// converging on a thermal's foot and spreading under the lid then comes from
+// the flow itself rather than from a hand-tuned height profile. The ground
+// and the lid are walls, and the sides are open.
+//
+// The scatter needs no atomics. Puffs are counting-sorted into bands of
+// kWindBand rows. A puff writes only to its own band and the first row of the
+// next, so all even bands run in parallel, then all odd ones. Every cell sums
+// its contributions in a fixed order, whatever the thread count.
+static const int kWindBand = 8;
+
+struct WindParams {
+    float shear = 0.8f;        // breeze runs from (1 - shear/2)× at the ground to (1 + shear/2)× at the top
+    float thermal = 20.f;      // px/s peak updraft over an emitter, at the ground
+    float subsidence = 1.5f;   // px/s sinking away from thermals
+    float buoyancy = 0.f;      // px/s² of updraft under full cloud cover; 0 → no deposit
+    float decay = 4.f;         // s, relaxation of the buoyant updraft
+    float maxW = 60.f;         // px/s cap on the buoyant updraft
+};
+
+struct ProjectStats {
+    uint64_t solves = 0, cycles = 0;
+    int maxCycles = 0;
+    int lastCycles = 0;
+    float lastResidual = 0.f, worstResidual = 0.f;   // relative, after the solve
+    float divBefore = 0.f, divAfter = 0.f;           // rms divergence of the last step, 1/s
+};
+
+class WindField {
+public:
+    int nx = 0, ny = 0;
+    float cellW = 1.f, cellH = 1.f;          // px per cell
+    AlignedVec<float> u, v;                  // total wind at cell centers, px/s, row 0 at the bottom
+    AlignedVec<float> w;                     // buoyant updraft on top of the base flow
+    AlignedVec<float> cover;                 // last deposit: puff area per cell area
+    WindParams params;
+    bool projectOn = false;                  // pressure projection after every step
+    MultigridPoisson poisson;
+    ProjectStats projectStats;
+
+    void init(int cellsX, int cellsY, int winW, int winH) {
+        nx = std::max(2, cellsX); ny = std::max(2, cellsY);
+        const size_t n = (size_t)nx*ny;
+        for (AlignedVec<float>* f : { &u, &v, &w, &cover, &vBase_ }) f->assign(n, 0.f);
+        resize(winW, winH);
+    }
+    void resize(int winW, int winH) {
+        cellW = (float)winW / nx; cellH = (float)winH / ny;
+        poisson.init(nx, ny, cellW, cellH);
+    }
+
+    // Thermals only move on resize. Unprojected, they weaken with height by
+    // hand. Projected, they are plain columns and the lid turns them; the
+    // projection hands about half of a column's lift to the subsidence around
+    // it, so those start twice as strong.
+    void setThermals(const std::vector<Emitter>& E) {
+        const WindParams& p = params;
+        const float fade = projectOn ? 0.f : 0.4f, gain = projectOn ? 2.0f : 1.f;
+        for (int j=0; j<ny; ++j) {
+            const float hn = (j + 0.5f) / ny;
+            for (int i=0; i<nx; ++i) {
+                const float x = (i + 0.5f) * cellW;
+                float up = -p.subsidence;
+                for (const Emitter& e : E) {
+                    const float c = 0.5f*(e.x0 + e.x1), sig = 0.6f*(e.x1 - e.x0) + 1.f;
+                    up += p.thermal * gain * (1.f - fade*hn) * std::exp(-((x - c)*(x - c)) / (sig*sig));
+                }
+                vBase_[(size_t)j*nx + i] = up;
+            }
+        }
+    }
+
+    WindView view() const { return WindView{ u.data(), v.data(), nx, ny, 1.f/cellW, 1.f/cellH }; }
+
+    // Bilinear scatter of whiten · πr² / cell area; see the section comment.
+    void deposit(const PuffField& P, TaskPool* pool) {
+        const size_t n = P.size();
+        const int bands = (ny - 2) / kWindBand + 1;     // rows a puff can anchor at: 0..ny-2
+        bandStart_.assign((size_t)bands + 1, 0);
+        bandOf_.resize(n); order_.resize(n);
+        for (size_t i=0; i<n; ++i) {
+            const int b = anchorRow(P.y[i]) / kWindBand;
+            bandOf_[i] = (uint32_t)b;
+            ++bandStart_[(size_t)b + 1];
+        }
+        for (int b=0; b<bands; ++b) bandStart_[(size_t)b + 1] += bandStart_[(size_t)b];
+        cursor_.assign(bandStart_.begin(), bandStart_.end() - 1);
+        for (size_t i=0; i<n; ++i) order_[cursor_[bandOf_[i]]++] = (uint32_t)i;
+        std::fill(cover.begin(), cover.end(), 0.f);
+
+        const float area = (float)M_PI / (cellW * cellH);
+        const float invW = 1.f/cellW;
+        auto band = [&](int b) {
+            for (uint32_t s = bandStart_[(size_t)b]; s < bandStart_[(size_t)b + 1]; ++s) {
+                const uint32_t i = order_[s];
+                const float gx = clampf(P.x[i]*invW - 0.5f, 0.f, (float)(nx - 1));
+                const float gy = clampf(P.y[i]/cellH - 0.5f, 0.f, (float)(ny - 1));
+                const int i0 = std::min(nx - 2, (int)gx), j0 = anchorRow(P.y[i]);
+                const float fx = gx - i0, fy = gy - j0;
+                const float a = P.whiten[i] * P.r[i] * P.r[i] * area;
+                float* c = &cover[(size_t)j0*nx + i0];
+                c[0]      += a * (1.f - fx) * (1.f - fy);
+                c[1]      += a * fx * (1.f - fy);
+                c[nx]     += a * (1.f - fx) * fy;
+                c[nx + 1] += a * fx * fy;
+            }
+        };
+        for (int color = 0; color < 2; ++color) {
+            const size_t count = (size_t)(bands - color + 1) / 2;
+            if (pool && pool->size() > 1 && count > 1) pool->parallelFor(count, [&](size_t k, int) { band(2*(int)k + color); });
+            else for (size_t k=0; k<count; ++k) band(2*(int)k + color);
+        }
+    }
+
+    // Advance the buoyant updraft and rebuild (u, v) for this breeze.
+    void step(float dt, float breeze, TaskPool* pool) {
+        const WindParams& p = params;
+        const float keep = std::max(0.f, 1.f - dt / p.decay), push = p.buoyancy * dt;
+        auto rows = [&](size_t b, int) {
+            const int j0 = (int)b * kWindBand, j1 = std::min(ny, j0 + kWindBand);
+            for (int j=j0; j<j1; ++j) {
+                const float hn = (j + 0.5f) / ny, uj = breeze * (1.f + p.shear*(hn - 0.5f));
+                const size_t r = (size_t)j*nx;
+                for (int i=0; i<nx; ++i) {
+                    float& wc = w[r + i];
+                    wc = std::min(p.maxW, wc*keep + std::min(1.f, cover[r + i])*push);
+                    u[r + i] = uj;
+                    v[r + i] = vBase_[r + i] + wc;
+                }
+            }
+        };
+        const size_t bands = (size_t)(ny + kWindBand - 1) / kWindBand;
+        if (pool && pool->size() > 1 && (size_t)nx*ny >= 65536) pool->parallelFor(bands, rows);
+        else for (size_t b=0; b<bands; ++b) rows(b, 0);
+    }
+
+    // Subtract the pressure gradient that cancels the divergence of (u, v), on a
+    // staggered (MAC) layout. Cell winds are averaged onto the faces. The normal
+    // wind is zero at the walls and extrapolated flat at the open sides. The face
+    // divergence is the solve's right-hand side, and the face gradient uses the
+    // solver's boundaries (p = 0 ghosts at the sides, no gradient through the
+    // walls). D·G is then exactly the solver's Laplacian, so the faces end up
+    // divergence-free to the solve tolerance. Cells take back the face averages.
+    void project(TaskPool* pool) {
+        AlignedVec<float>& div = poisson.rhs();
+        const size_t fx = (size_t)nx + 1;
+        fu_.resize(fx*ny); fv_.resize((size_t)nx*(ny + 1));
+        for (int j=0; j<ny; ++j) {
+            const float* c = &u[(size_t)j*nx];
+            float* f = &fu_[j*fx];
+            f[0] = c[0]; f[nx] = c[nx-1];
+            for (int i=1; i<nx; ++i) f[i] = 0.5f*(c[i-1] + c[i]);
+        }
+        for (int j=0; j<=ny; ++j) {
+            float* f = &fv_[(size_t)j*nx];
+            for (int i=0; i<nx; ++i) f[i] = j == 0 || j == ny ? 0.f : 0.5f*(v[(size_t)(j-1)*nx + i] + v[(size_t)j*nx + i]);
+        }
+        ProjectStats& st = projectStats;
+        st.divBefore = divergence(div);
+        float residual = 0.f;
+        const int cycles = poisson.solve(pool, residual);
+        const AlignedVec<float>& p = poisson.solution();
+        const float gx = 1.f/cellW, gy = 1.f/cellH;
+        for (int j=0; j<ny; ++j) {
+            const float* c = &p[(size_t)j*nx];
+            float* f = &fu_[j*fx];
+            f[0] -= 2.f*c[0]*gx;
+            f[nx] += 2.f*c[nx-1]*gx;
+            for (int i=1; i<nx; ++i) f[i] -= (c[i] - c[i-1])*gx;
+            if (j > 0) {
+                float* g = &fv_[(size_t)j*nx];
+                for (int i=0; i<nx; ++i) g[i] -= (c[i] - c[i - nx])*gy;
+            }
+        }
+        for (int j=0; j<ny; ++j) {
+            const float* f = &fu_[j*fx];
+            const float* g = &fv_[(size_t)j*nx];
+            for (int i=0; i<nx; ++i) {
+                u[(size_t)j*nx + i] = 0.5f*(f[i] + f[i+1]);
+                v[(size_t)j*nx + i] = 0.5f*(g[i] + g[i + nx]);
+            }
+        }
+        st.divAfter = divergence(div);       // the solve is done with the rhs
+        ++st.solves;
+        st.cycles += (uint64_t)cycles;
+        st.lastCycles = cycles;
+        st.maxCycles = std::max(st.maxCycles, cycles);
+        st.lastResidual = residual;
+        st.worstResidual = std::max(st.worstResidual, residual);
+    }
+
+    float peakUpdraft() const { return w.empty() ? 0.f : *std::max_element(w.begin(), w.end()); }
+
+private:
+    // Writes the face divergence of the staggered wind into out and returns its rms.
+    float divergence(AlignedVec<float>& out) const {
+        const float kx = 1.f/cellW, ky = 1.f/cellH;
+        const size_t fx = (size_t)nx + 1;
+        double sum = 0.0;
+        for (int j=0; j<ny; ++j) {
+            const float* f = &fu_[j*fx];
+            const float* g = &fv_[(size_t)j*nx];
+            for (int i=0; i<nx; ++i) {
+                const float d = (f[i+1] - f[i])*kx + (g[i + nx] - g[i])*ky;
+                out[(size_t)j*nx + i] = d;
+                sum += (double)d*d;
+            }
+        }
+        return (float)std::sqrt(sum / ((double)nx*ny));
+    }
+
+    // Lower row of the bilinear stencil, the same in the sort and the scatter.
+    int anchorRow(float y) const { return std::min(ny - 2, (int)clampf(y/cellH - 0.5f, 0.f, (float)(ny - 1))); }
+
+    AlignedVec<float> vBase_;
+    AlignedVec<float> fu_, fv_;              // project(): (nx+1)×ny and nx×(ny+1) face winds
+    std::vector<uint32_t> bandOf_, order_, bandStart_, cursor_;
+};
+
+// ---------- atmosphere grid ----------
+// Optional Eulerian layer under the puffs. Cell-centered water vapour mixing
+// ratio qv, potential temperature theta and condensate qc (kg/kg, K) are
+// advected semi-Lagrangianly by the wind (u, v) in px/s of a WindField with the
+// same cell layout. After advection, a linearized saturation adjustment condenses
+// or evaporates toward the saturation mixing ratio and releases latent heat, and
+// everything relaxes slowly toward a stable environmental profile. Emitters
+// become surface moisture and heat sources, and puffs are seeded where
+// condensate builds up, so clouds appear where rising moist air saturates.
+// The window height maps to kAtmosDepth metres. Kernels run over 2D tiles on
+// the TaskPool, with SIMD lanes across each tile row. Every cell depends only on
+// the previous state, so results do not depend on the thread count.
+static const float kAtmosDepth = 4000.f;     // m spanned by the window height
+static const int   kAtmosTileX = 128, kAtmosTileY = 32;
+
+struct AtmosParams {
+    float lapse = 4.f;          // K/km rise of environmental theta (stable)
+    float envRH = 0.6f;         // relative humidity of the environment
+    float relax = 90.f;         // s, relaxation of qv/theta toward the environment
+    float rainout = 120.f;      // s, condensate loss
+    float surfaceRH = 0.5f;     // target RH under an emitter, +0.04 per emitter rate unit
+    float surfaceHeat = 1.5f;   // K of surface warming under a rate-1 emitter
+    float seedQc = 2e-4f;       // condensate above which cells seed puffs
+    float seedRate = 3.f;       // seeds per cell-second per kg/kg of excess condensate
+    float seedMass = 3e-4f;     // condensate removed from the cell per seeded puff
+};
+
+class AtmosGrid {
+public:
+    int nx = 0, ny = 0;
+    float cellW = 1.f, cellH = 1.f;          // px per cell
+    AlignedVec<float> qv, theta, qc;         // state, row-major, row 0 at the bottom
+    AtmosParams params;
+    uint64_t seeded = 0;
+
+    void init(int cellsX, int cellsY, int winW, int winH) {
+        nx = std::max(2, cellsX); ny = std::max(2, cellsY);
+        const size_t n = (size_t)nx*ny;
+        for (AlignedVec<float>* f : { &qv, &theta, &qc, &qv2_, &theta2_, &qc2_ }) f->assign(n, 0.f);
+        esTable_ = esTable().data();
+        resize(winW, winH);
+        for (int j=0; j<ny; ++j)
+            for (int i=0; i<nx; ++i) {
+                qv[(size_t)j*nx + i] = qvEnv_[j];
+                theta[(size_t)j*nx + i] = thetaEnv_[j];
+            }
+    }
+
+    // Rescale to a new window; the state keeps its cell layout.
+    void resize(int winW, int winH) {
+        cellW = (float)winW / nx; cellH = (float)winH / ny;
+        exner_.resize(ny); pres_.resize(ny); thetaEnv_.resize(ny); qvEnv_.resize(ny);
+        for (int j=0; j<ny; ++j) {
+            const float z = (j + 0.5f) * kAtmosDepth / ny;
+            pres_[j] = 1000.f * std::exp(-z / 8000.f);              // hPa, scale height 8 km
+            exner_[j] = std::pow(pres_[j] / 1000.f, 0.2857f);
+            thetaEnv_[j] = 300.f + params.lapse * z * 1e-3f;
+            qvEnv_[j] = params.envRH * saturationMixingRatio(thetaEnv_[j]*exner_[j], pres_[j]);
+        }
+    }
+
+    void step(float dt, const std::vector<Emitter>& E, const WindField& W, TaskPool* pool) {
+        applySources(dt, E);
+        const int tx = (nx + kAtmosTileX - 1) / kAtmosTileX, ty = (ny + kAtmosTileY - 1) / kAtmosTileY;
+        auto tile = [&](size_t t, int) {
+            const int i0 = (int)(t % tx) * kAtmosTileX, j0 = (int)(t / tx) * kAtmosTileY;
+            const int i1 = std::min(nx, i0 + kAtmosTileX), j1 = std::min(ny, j0 + kAtmosTileY);
+            for (int j=j0; j<j1; ++j) {
+                int i = advectRow<SimdF>(W, j, i0, i1, dt);
+                advectRow<ScalarF>(W, j, i, i1, dt);
+                i = physicsRow<SimdF>(j, i0, i1, dt);
+                physicsRow<ScalarF>(j, i, i1, dt);
+            }
+        };
+        const size_t tiles = (size_t)tx*ty;
+        if (pool && pool->size() > 1 && tiles > 1) pool->parallelFor(tiles, tile);
+        else for (size_t t=0; t<tiles; ++t) tile(t, 0);
+        qv.swap(qv2_); theta.swap(theta2_); qc.swap(qc2_);
+    }
+
+    // Turns excess condensate into puffs, scanning cells in order so the draws
+    // from rng are reproducible. Seeds take the growth and lifetime multipliers
+    // of `like`. Returns the number seeded.
+    int seedPuffs(PuffField& P, const Emitter& like, float dt, Rng& rng) {
+        const AtmosParams& a = params;
+        int placed = 0;
+        for (int j=0; j<ny; ++j)
+            for (int i=0; i<nx; ++i) {
+                float& c = qc[(size_t)j*nx + i];
+                if (c <= a.seedQc) continue;
+                if (rng.uniform() >= (c - a.seedQc) * a.seedRate * dt) continue;
+                Emitter cell{ i*cellW, (i+1)*cellW, j*cellH, 0.f, like.growth, like.life };
+                if (spawnPuffs(P, cell, 1, rng)) { c = std::max(0.f, c - a.seedMass); ++placed; }
+            }
+        seeded += placed;
+        return placed;
+    }
+
+    float cloudFraction() const {
+        size_t k = 0;
+        for (float c : qc) k += c > params.seedQc;
+        return qc.empty() ? 0.f : (float)k / qc.size();
+    }
+
+private:
+    static constexpr float kEsT0 = 180.f, kEsPerK = 4.f;
+    static const int kEsEntries = 160 * 4;   // 180..340 K in 0.25 K steps
+
+    static float saturationVapourPressure(float T) {     // Tetens, over water, hPa
+        return 6.1078f * std::exp(17.27f * (T - 273.15f) / (T - 35.86f));
+    }
+    static float saturationMixingRatio(float T, float p) { return 0.622f * saturationVapourPressure(T) / p; }
+    // Depends on nothing but the constants above, so every grid (every ensemble
+    // member) reads one copy.
+    static const std::vector<float>& esTable() {
+        static const std::vector<float> table = []{
+            std::vector<float> t(kEsEntries + 1);
+            for (int k=0; k<=kEsEntries; ++k) t[k] = saturationVapourPressure(kEsT0 + k/kEsPerK);
+            return t;
+        }();
+        return table;
+    }
+
+    // Nudge the lowest rows under each emitter toward a humid, warm surface state.
+    void applySources(float dt, const std::vector<Emitter>& E) {
+        const AtmosParams& a = params;
+        for (const Emitter& e : E) {
+            const int i0 = std::max(0, (int)(e.x0 / cellW)), i1 = std::min(nx, (int)std::ceil(e.x1 / cellW));
+            const int j1 = std::min(ny, std::max(1, (int)std::ceil(e.y / cellH)));
+            const float rh = std::min(0.95f, a.surfaceRH + 0.04f*e.rate);
+            const float k = std::min(1.f, dt * 0.5f);
+            for (int j=0; j<j1; ++j) {
+                const float target = rh * saturationMixingRatio(thetaEnv_[j]*exner_[j], pres_[j]);
+                for (int i=i0; i<i1; ++i) {
+                    const size_t c = (size_t)j*nx + i;
+                    qv[c] += (std::max(qv[c], target) - qv[c]) * k;
+                    theta[c] += (thetaEnv_[j] + a.surfaceHeat*e.rate - theta[c]) * k * 0.25f;
+                }
+            }
+        }
+    }
+
+    // Semi-Lagrangian: trace each center back along the wind and sample the old
+    // fields bilinearly (four gathers per field), clamping at the domain edges.
+    template <class V>
+    int advectRow(const WindField& W, int j, int i, int end, float dt) {
+        typedef typename V::T T;
+        static const float iota[8] = { 0, 1, 2, 3, 4, 5, 6, 7 };
+        const T kx = V::set1(dt / cellW), ky = V::set1(dt / cellH);
+        const T zero = V::set1(0.f);
+        const T maxX = V::set1((float)(nx - 1)), maxY = V::set1((float)(ny - 1));
+        const T lastX = V::set1((float)(nx - 2)), lastY = V::set1((float)(ny - 2));
+        const T stride = V::set1((float)nx), row = V::set1((float)j);
+        for (; i + V::N <= end; i += V::N) {
+            const size_t c = (size_t)j*nx + i;
+            T x = V::add(V::set1((float)i), V::load(iota));
+            T xd = V::max(zero, V::min(maxX, V::sub(x, V::mul(V::load(&W.u[c]), kx))));
+            T yd = V::max(zero, V::min(maxY, V::sub(row, V::mul(V::load(&W.v[c]), ky))));
+            T x0 = V::min(lastX, V::floor(xd)), y0 = V::min(lastY, V::floor(yd));
+            T fx = V::sub(xd, x0), fy = V::sub(yd, y0);
+            typename V::I k = V::index(V::add(V::mul(y0, stride), x0));
+            auto sample = [&](const AlignedVec<float>& f) {
+                const float* p = f.data();
+                T a = V::gather(p, k), b = V::gather(p + 1, k);
+                T d = V::gather(p + nx, k), e = V::gather(p + nx + 1, k);
+                T lo = V::add(a, V::mul(fx, V::sub(b, a)));
+                T hi = V::add(d, V::mul(fx, V::sub(e, d)));
+                return V::add(lo, V::mul(fy, V::sub(hi, lo)));
+            };
+            V::store(&qv2_[c], sample(qv));
+            V::store(&theta2_[c], sample(theta));
+            V::store(&qc2_[c], V::max(zero, sample(qc)));
+        }
+        return i;
+    }
+
+    // Saturation adjustment linearized about the current temperature:
+    // dq = (qv - qs) / (1 + L² qs / (cp Rv T²)), limited by the condensate on hand
+    // when evaporating, then relaxation and rain-out.
+    template <class V>
+    int physicsRow(int j, int i, int end, float dt) {
+        typedef typename V::T T;
+        const AtmosParams& a = params;
+        const T exner = V::set1(exner_[j]), invP = V::set1(0.622f / pres_[j]);
+        const T lcp = V::set1(2.5e6f / 1004.f);                      // L/cp
+        const T gammaK = V::set1(2.5e6f * 2.5e6f / (1004.f * 461.5f)); // L²/(cp Rv)
+        const T t0 = V::set1(kEsT0), perK = V::set1(kEsPerK), tMax = V::set1((float)kEsEntries - 1.f);
+        const T zero = V::set1(0.f), one = V::set1(1.f);
+        const T kRelax = V::set1(std::min(1.f, dt / a.relax)), kRain = V::set1(std::min(1.f, dt / a.rainout));
+        const T qEnv = V::set1(qvEnv_[j]), thEnv = V::set1(thetaEnv_[j]);
+        for (; i + V::N <= end; i += V::N) {
+            const size_t c = (size_t)j*nx + i;
+            T q = V::load(&qv2_[c]), th = V::load(&theta2_[c]), w = V::load(&qc2_[c]);
+            T temp = V::mul(th, exner);
+            T ti = V::max(zero, V::min(tMax, V::mul(V::sub(temp, t0), perK)));
+            T t0i = V::floor(ti), f = V::sub(ti, t0i);
+            typename V::I k = V::index(t0i);
+            T e0 = V::gather(esTable_, k), e1 = V::gather(esTable_ + 1, k);
+            T qs = V::mul(invP, V::add(e0, V::mul(f, V::sub(e1, e0))));
+            T dq = V::div(V::sub(q, qs), V::add(one, V::div(V::mul(gammaK, qs), V::mul(temp, temp))));
+            dq = V::max(dq, V::sub(zero, w));                           // cannot evaporate more than there is
+            q = V::sub(q, dq);
+            w = V::add(w, dq);
+            th = V::add(th, V::div(V::mul(lcp, dq), exner));
+            q = V::add(q, V::mul(V::sub(qEnv, q), kRelax));
+            th = V::add(th, V::mul(V::sub(thEnv, th), kRelax));
+            w = V::sub(w, V::mul(w, kRain));
+            V::store(&qv2_[c], q); V::store(&theta2_[c], th); V::store(&qc2_[c], w);
+        }
+        return i;
+    }
+
+    AlignedVec<float> qv2_, theta2_, qc2_;
+    const float* esTable_ = nullptr;
+    std::vector<float> exner_, pres_, thetaEnv_, qvEnv_;
+};
+
+// ---------- simulation ----------
+// The whole atmosphere, free of SDL and GL: the window app, the headless driver
+// and the benchmarks all step one of these.
+struct Simulation {
+    int winW, winH;
+    std::vector<Emitter> emitters;        // moist thermals / convergence lines
+    std::vector<float>   emitterTimers;   // fractional puffs owed per emitter
+    float breeze = 12.f;                  // pixels/sec → “wind”
+    PuffField puffs;
+    Rng rng;
+    RetireMode retire = RETIRE_STABLE;
+    UpdateScratch scratch;
+    TaskPool* pool = nullptr;             // shared, not owned; null → single-threaded
+    PuffGrid grid;
+    float gridCell = 0.f;                 // > 0: rebuild grid and reorder puffs every step
+    bool coalesce = false;                // merge/split pass on the grid (forces one)
+    MergeParams mergeParams;
+    MergeScratch mergeScratch;
+    MergeStats mergeStats;
+    WindField wind;
+    bool windOn = false;                  // puffs ride the gridded wind instead of the uniform breeze
+    AtmosGrid atmos;
+    bool atmosOn = false;                 // emitters feed the grid; saturation seeds the puffs
+    double time = 0.0;
+    uint64_t steps = 0;
+
+    Simulation(int w, int h, uint64_t seed) : winW(w), winH(h), rng(seed) {
+        emitters = {
+            { 0.f, 0.f, 0.f, 4.0f },   // left thermal
+            { 0.f, 0.f, 0.f, 3.2f }    // right thermal
+        };
+        emitterTimers.assign(emitters.size(), 0.f);
+        resize(w, h);
+    }
+
+    // Keep emitters anchored near ground.
+    void resize(int w, int h) {
+        winW = w; winH = h;
+        emitters[0].x0 = winW*0.18f; emitters[0].x1 = winW*0.38f; emitters[0].y = 110.f;
+        emitters[1].x0 = winW*0.55f; emitters[1].x1 = winW*0.82f; emitters[1].y = 110.f;
+        if (windOn) { wind.resize(w, h); wind.setThermals(emitters); }
+        if (atmosOn) atmos.resize(w, h);
+    }
+    void enableWind(int cellsX, int cellsY) {
+        wind.init(cellsX, cellsY, winW, winH);
+        wind.setThermals(emitters);
+        windOn = true;
+    }
+    void enableProjection(float tolerance) {
+        if (!windOn) enableWind(128, 80);
+        wind.projectOn = true;
+        wind.poisson.tolerance = tolerance;
+        wind.setThermals(emitters);
+    }
+    // The atmosphere is advected by the wind grid, so that takes the same cells.
+    void enableAtmosphere(int cellsX, int cellsY) {
+        enableWind(cellsX, cellsY);
+        atmos.init(cellsX, cellsY, winW, winH);
+        atmosOn = true;
+    }
+    void nudgeBreeze(float d) { breeze += d; }
+    void raiseHumidity() { for (auto& e: emitters) e.rate += 0.8f; }   // “humid day” → more emission
+    void lowerHumidity() { for (auto& e: emitters) e.rate = std::max(0.6f, e.rate - 0.8f); }
+
+    void step(float dt) {
+        puffs.forgetOldest();
+        if (windOn) {
+            PROF_SCOPE(PH_WIND);
+            if (wind.params.buoyancy > 0.f) wind.deposit(puffs, pool);
+            wind.step(dt, breeze, pool);
+        }
+        if (windOn && wind.projectOn) {
+            PROF_SCOPE(PH_PROJECT);
+            wind.project(pool);
+        }
+        if (atmosOn) {
+            PROF_SCOPE(PH_ATMOS);
+            atmos.step(dt, emitters, wind, pool);
+            atmos.seedPuffs(puffs, emitters[0], dt, rng);
+        } else {
+            PROF_SCOPE(PH_SPAWN);
+            // spawn puffs from emitters (Poisson-ish)
+            for (size_t k=0; k<emitters.size(); ++k) {
+                float& t = emitterTimers[k];
+                t += dt*emitters[k].rate;
+                if (t >= 1.f) { int n = (int)t; spawnPuffs(puffs, emitters[k], n, rng); t -= n; }
+            }
+
+            // occasionally seed mid-level moisture to hint anvils/merging
+            if (rng.uniform() < 0.02f*dt*60.f) {
+                Emitter mid{ winW*0.30f, winW*0.70f, winH*0.45f + rng.uniform()*50.f, 1.0f,
+                             emitters[0].growth, emitters[0].life };
+                spawnPuffs(puffs, mid, 1, rng);
+            }
+        }
+
+        // update “atmosphere”
+        StepParams sp{ dt, breeze, (float)winW, (float)winH, WindView() };
+        if (windOn) sp.wind = wind.view();
+        {
+            PROF_SCOPE(PH_UPDATE);
+            updatePuffs(puffs, sp, retire, scratch, pool);
+        }
+        if (gridCell > 0.f || coalesce) {
+            PROF_SCOPE(PH_GRID);
+            grid.build(puffs, gridCell > 0.f ? gridCell : 64.f, winW, winH, pool);
+            grid.reorder(puffs, pool);
+        }
+        if (coalesce) {
+            PROF_SCOPE(PH_MERGE);
+            coalescePuffs(puffs, grid, mergeParams, retire, mergeScratch, rng, mergeStats);
+        }
+        time += dt;
+        ++steps;
+    }
+};
+
+// ---------- simulation thread ----------
+// Optional mode: the Simulation ticks at a fixed rate on its own thread and
+// publishes render snapshots through a lock-free triple buffer; the render
+// thread draws one tick behind, interpolating between the last two snapshots.
+
+// Single producer / single consumer. The writer fills back() and publish()es it;
+// the reader calls update() to take the newest published buffer, if any.
+template <class T>
+class TripleBuffer {
+public:
+    T& back() { return buf_[back_]; }
+    void publish() { back_ = middle_.exchange(back_ | kFresh, std::memory_order_acq_rel) & 3; }
+
+    bool fresh() const { return (middle_.load(std::memory_order_acquire) & kFresh) != 0; }
+    bool update() {
+        if (!fresh()) return false;
+        front_ = middle_.exchange(front_, std::memory_order_acq_rel) & 3;
+        return true;
+    }
+    const T& front() const { return buf_[front_]; }
+
+private:
+    enum { kFresh = 4 };
+    T buf_[3];
+    int back_ = 0, front_ = 2;
+    std::atomic<int> middle_{1};
+};
+
+struct RenderSnapshot {
+    double published = 0.0;   // SimThread::wallTime() when published; the render clock
+    float  winW = 0.f;
+    std::vector<uint32_t> id;
+    std::vector<float> x, y, r, whiten;
+
+    void capture(const Simulation& sim) {
+        const PuffField& P = sim.puffs;
+        winW = (float)sim.winW;
+        id.assign(P.id.begin(), P.id.end());
+        x.assign(P.x.begin(), P.x.end());
+        y.assign(P.y.begin(), P.y.end());
+        r.assign(P.r.begin(), P.r.end());
+        whiten.assign(P.whiten.begin(), P.whiten.end());
+    }
+};
+
+class SimThread {
+public:
+    SimThread(Simulation& sim, float tick) : sim_(sim), tick_(tick) {}
+    ~SimThread() { stop(); }
+
+    void start() {
+        start_ = std::chrono::steady_clock::now();
+        quit_ = false;
+        th_ = std::thread([this]{ run(); });
+    }
+    void stop() {
+        if (!th_.joinable()) return;
+        quit_ = true;
+        th_.join();
+    }
+
+    // Controls from the UI thread, applied at the start of the next tick.
+    void postBreeze(float d)  { std::lock_guard<std::mutex> lk(m_); in_.breeze += d; }
+    void postHumidity(int d)  { std::lock_guard<std::mutex> lk(m_); in_.humidity += d; }
+    void postResize(int w, int h) { std::lock_guard<std::mutex> lk(m_); in_.w = w; in_.h = h; }
+    // Called on the sim thread after every tick; set before start().
+    void setOnTick(std::function<void(const Simulation&)> fn) { onTick_ = std::move(fn); }
+
+    TripleBuffer<RenderSnapshot>& snapshots() { return tb_; }
+    float tick() const { return tick_; }
+    double wallTime() const {
+        return std::chrono::duration<double>(std::chrono::steady_clock::now() - start_).count();
+    }
+
+private:
+    struct Inputs { float breeze = 0.f; int humidity = 0; int w = 0, h = 0; };
+
+    void run() {
+        auto deadline = start_;
+        const auto tickDur = std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+            std::chrono::duration<double>(tick_));
+        while (!quit_) {
+            Inputs in;
+            { std::lock_guard<std::mutex> lk(m_); in = in_; in_ = Inputs(); }
+            if (in.breeze != 0.f) sim_.nudgeBreeze(in.breeze);
+            for (; in.humidity > 0; --in.humidity) sim_.raiseHumidity();
+            for (; in.humidity < 0; ++in.humidity) sim_.lowerHumidity();
+            if (in.w > 0) sim_.resize(in.w, in.h);
+
+            sim_.step(tick_);
+            if (onTick_) onTick_(sim_);
+            tb_.back().capture(sim_);
+            tb_.back().published = wallTime();
+            tb_.publish();
+
+            deadline += tickDur;
+            auto now = std::chrono::steady_clock::now();
+            if (now > deadline + 5*tickDur) deadline = now;   // fell behind: don't spiral
+            std::this_thread::sleep_until(deadline);
+        }
+    }
+
+    Simulation& sim_;
+    float tick_;
+    std::chrono::steady_clock::time_point start_;
+    std::atomic<bool> quit_{false};
+    std::thread th_;
+    std::mutex m_;
+    Inputs in_;
+    TripleBuffer<RenderSnapshot> tb_;
+    std::function<void(const Simulation&)> onTick_;
+};
+
+// Render side: keeps the previous snapshot and blends each live puff from its
+// position there (matched by id) to the newest one. New puffs pop in at their
+// current position; puffs that wrapped horizontally aren't blended across the seam.
+class SnapshotInterpolator {
+public:
+    PuffView view(TripleBuffer<RenderSnapshot>& tb, double renderTime) {
+        if (tb.fresh()) {
+            prev_ = tb.front();
+            tb.update();
+            indexPrev();
+        }
+        const RenderSnapshot& cur = tb.front();
+        const size_t n = cur.id.size();
+        x_.resize(n); y_.resize(n); r_.resize(n); w_.resize(n);
+        // Blend on the clock the snapshots were published on, not sim.time: that
+        // starts wherever a restored run left off, and after the sim thread
+        // drops ticks to catch up it no longer tracks the wall clock.
+        double span = cur.published - prev_.published;
+        float a = span > 0.0 ? clampf((float)((renderTime - prev_.published) / span), 0.f, 1.f) : 1.f;
+        for (size_t i=0; i<n; ++i) {
+            long j = -1;
+            uint32_t k = cur.id[i] - minId_;
+            if (k < slot_.size()) j = slot_[k];
+            if (j < 0 || std::fabs(cur.x[i] - prev_.x[j]) > 0.5f*cur.winW) {
+                x_[i] = cur.x[i]; y_[i] = cur.y[i]; r_[i] = cur.r[i]; w_[i] = cur.whiten[i];
+                continue;
+            }
+            x_[i] = prev_.x[j] + (cur.x[i] - prev_.x[j])*a;
+            y_[i] = prev_.y[j] + (cur.y[i] - prev_.y[j])*a;
+            r_[i] = prev_.r[j] + (cur.r[i] - prev_.r[j])*a;
+            w_[i] = prev_.whiten[j] + (cur.whiten[i] - prev_.whiten[j])*a;
+        }
+        return PuffView{ x_.data(), y_.data(), r_.data(), w_.data(), n };
+    }
+
+private:
+    // id → index in prev_. Live ids span a window about as wide as the population,
+    // so a dense table beats a hash map; a pathological span just disables blending.
+    void indexPrev() {
+        slot_.clear();
+        if (prev_.id.empty()) return;
+        uint32_t lo = prev_.id[0], hi = prev_.id[0];
+        for (uint32_t v : prev_.id) { lo = std::min(lo, v); hi = std::max(hi, v); }
+        if (hi - lo > 8*prev_.id.size() + 4096) return;
+        minId_ = lo;
+        slot_.assign((size_t)(hi - lo) + 1, -1);
+        for (size_t j=0; j<prev_.id.size(); ++j) slot_[prev_.id[j] - lo] = (int32_t)j;
+    }
+
+    RenderSnapshot prev_;
+    std::vector<int32_t> slot_;
+    uint32_t minId_ = 0;
+    std::vector<float> x_, y_, r_, w_;
+};
+
+// Puff tint: bluish-grey near source, turns white as it matures; smaller puffs
+// get a higher center alpha, larger ones get softer.
+static inline float puffTint(float whiten, float r, GLfloat rgb[3]) {
+    float w = whiten;
+    rgb[0] = 0.85f*w + 0.75f*(1.f-w);
+    rgb[1] = 0.86f*w + 0.78f*(1.f-w);
+    rgb[2] = 0.90f*w + 0.82f*(1.f-w);
+    return 0.22f * (1.0f / (1.0f + 0.004f*r));
+}
+
+static const int kPuffRings = 9;
+
+// Soft compositing: draw many overlapping blobs to suggest merging/formation
+static void drawClouds(const PuffView& P) {
+    for (size_t i=0; i<P.n; ++i) {
+        GLfloat rgb[3];
+        float peak = puffTint(P.whiten[i], P.r[i], rgb);
+        drawSoftBlob(P.x[i], P.y[i], P.r[i], rgb, peak, kPuffRings);
+    }
+}
+
+// ---------- snapshots ----------
+// Save and resume a run. A snapshot holds everything a Simulation carries from
+// one step to the next: puffs, emitters and their timers, the breeze, the rng,
+// the wind grid's buoyant updraft and pressure, and the atmosphere fields. Run
+// with the same options, a restored simulation continues bit-identically.
+// Options themselves are not saved, and neither is anything rebuilt every step
+// (the spatial grid, the composed wind, scratch).
+//
+// File layout, little-endian (the byte order of every target we build for):
+//   "CLDSNAP\0", u32 version, u32 block count
+//   per block: char tag[4], u32 codec, u32 element size, u32 FNV-1a of the raw
+//              bytes, u64 raw bytes, u64 stored bytes, then the payload
+// Scalars sit in a few small blocks ("SIM ", "WIND", "ATMS"). Each per-puff or
+// per-cell array is a column block of its own, so a reader can take one column
+// without the rest. Codec 1 is a byte shuffle, then run-length coding. The
+// shuffle gathers byte k of every element, so slowly varying sign and exponent
+// bytes become long runs. A block is stored raw when coding would not shrink it.
+static const uint32_t kSnapVersion = 1;
+static const char kSnapMagic[8] = { 'C','L','D','S','N','A','P','\0' };
+enum SnapCodec { SNAP_RAW = 0, SNAP_SHUFFLE_RLE = 1 };
+
+struct SnapBlock {
+    char tag[4];
+    uint32_t elemSize = 1;
+    std::vector<uint8_t> raw;
+};
+
+struct SnapshotImage {
+    std::vector<SnapBlock> blocks;
+    size_t used = 0;                 // blocks past this keep their buffers for the next capture
+
+    void clear() { used = 0; }
+    SnapBlock& add(const char* tag, uint32_t elemSize) {
+        if (used == blocks.size()) blocks.emplace_back();
+        SnapBlock& b = blocks[used++];
+        std::memcpy(b.tag, tag, 4);
+        b.elemSize = elemSize;
+        b.raw.clear();
+        return b;
+    }
+    const SnapBlock* find(const char* tag) const {
+        for (size_t i=0; i<used; ++i) if (!std::memcmp(blocks[i].tag, tag, 4)) return &blocks[i];
+        return nullptr;
+    }
+};
+
+template <class T> static void snapPut(std::vector<uint8_t>& b, const T& v) {
+    static_assert(std::is_trivially_copyable<T>::value, "plain data only");
+    const uint8_t* p = (const uint8_t*)&v;
+    b.insert(b.end(), p, p + sizeof(T));
+}
+
+// Reads scalars back in order; ok turns false on a short block.
+struct SnapReader {
+    const std::vector<uint8_t>& b;
+    size_t at;
+    bool ok;
+    explicit SnapReader(const std::vector<uint8_t>& bytes) : b(bytes), at(0), ok(true) {}
+    template <class T> T get() {
+        T v{};
+        if (at + sizeof(T) > b.size()) { ok = false; return v; }
+        std::memcpy(&v, &b[at], sizeof(T));
+        at += sizeof(T);
+        return v;
+    }
+};
+
+template <class Vec> static void snapColumn(SnapshotImage& img, const char* tag, const Vec& c) {
+    SnapBlock& b = img.add(tag, (uint32_t)sizeof(c[0]));
+    b.raw.resize(c.size() * sizeof(c[0]));
+    if (!c.empty()) std::memcpy(b.raw.data(), c.data(), b.raw.size());
+}
+
+// False if the block is missing or does not hold exactly n elements.
+template <class Vec> static bool snapLoadColumn(const SnapshotImage& img, const char* tag, Vec& c, size_t n) {
+    const SnapBlock* b = img.find(tag);
+    if (!b || b->elemSize != sizeof(c[0]) || b->raw.size() != n * sizeof(c[0])) return false;
+    c.resize(n);
+    if (n) std::memcpy(c.data(), b->raw.data(), b->raw.size());
+    return true;
+}
+
+static uint32_t fnv1a(const uint8_t* p, size_t n) {
+    uint32_t h = 2166136261u;
+    for (size_t i=0; i<n; ++i) { h ^= p[i]; h *= 16777619u; }
+    return h;
+}
+
+// Byte shuffle, then PackBits-style runs. A control byte c < 128 copies the
+// next c + 1 bytes; c >= 128 repeats the next byte c - 125 times (3..130).
+static void snapEncode(const std::vector<uint8_t>& raw, uint32_t elem,
+                       std::vector<uint8_t>& shuf, std::vector<uint8_t>& out) {
+    const size_t n = raw.size() / elem;
+    shuf.resize(raw.size());
+    for (size_t k=0; k<elem; ++k)
+        for (size_t i=0; i<n; ++i) shuf[k*n + i] = raw[i*elem + k];
+    out.clear();
+    const size_t m = shuf.size();
+    size_t i = 0;
+    while (i < m) {
+        size_t run = 1;
+        while (i + run < m && run < 130 && shuf[i + run] == shuf[i]) ++run;
+        if (run >= 3) {
+            out.push_back((uint8_t)(run + 125));
+            out.push_back(shuf[i]);
+            i += run;
+            continue;
+        }
+        size_t end = i;                                   // literals up to the next run of 3
+        while (end < m && end - i < 128) {
+            if (end + 2 < m && shuf[end] == shuf[end+1] && shuf[end] == shuf[end+2]) break;
+            ++end;
+        }
+        out.push_back((uint8_t)(end - i - 1));
+        out.insert(out.end(), shuf.begin() + i, shuf.begin() + end);
+        i = end;
+    }
+}
+
+static bool snapDecode(const uint8_t* p, size_t n, uint32_t elem, size_t rawBytes,
+                       std::vector<uint8_t>& shuf, std::vector<uint8_t>& raw) {
+    shuf.clear();
+    for (size_t i=0; i<n; ) {
+        const uint8_t c = p[i++];
+        if (c < 128) {
+            if (i + c + 1 > n) return false;
+            shuf.insert(shuf.end(), p + i, p + i + c + 1);
+            i += c + 1;
+        } else {
+            if (i >= n) return false;
+            shuf.insert(shuf.end(), (size_t)c - 125, p[i++]);
+        }
+        if (shuf.size() > rawBytes) return false;
+    }
+    if (shuf.size() != rawBytes) return false;
+    const size_t count = rawBytes / elem;
+    raw.resize(rawBytes);
+    for (size_t k=0; k<elem; ++k)
+        for (size_t i=0; i<count; ++i) raw[i*elem + k] = shuf[k*count + i];
+    return true;
+}
+
+struct SnapStats {
+    uint64_t written = 0, skipped = 0, failed = 0;
+    uint64_t rawBytes = 0, storedBytes = 0;   // of the last snapshot written
+};
+
+// Writes path.tmp and renames it over path, so a run killed mid-write keeps
+// the previous snapshot.
+static bool writeSnapshotFile(const std::string& path, const SnapshotImage& img,
+                              std::vector<uint8_t>& shuf, std::vector<uint8_t>& packed, SnapStats& st) {
+    const std::string tmp = path + ".tmp";
+    FILE* f = std::fopen(tmp.c_str(), "wb");
+    if (!f) { std::fprintf(stderr, "snapshot: cannot write %s\n", tmp.c_str()); return false; }
+    uint64_t rawTotal = 0, storedTotal = 0;
+    const uint32_t count = (uint32_t)img.used;
+    bool ok = std::fwrite(kSnapMagic, 1, 8, f) == 8 &&
+              std::fwrite(&kSnapVersion, 4, 1, f) == 1 && std::fwrite(&count, 4, 1, f) == 1;
+    for (size_t k=0; ok && k<img.used; ++k) {
+        const SnapBlock& b = img.blocks[k];
+        uint32_t codec = SNAP_RAW;
+        const uint8_t* payload = b.raw.data();
+        uint64_t stored = b.raw.size();
+        if (b.elemSize > 1 && b.raw.size() % b.elemSize == 0) {
+            snapEncode(b.raw, b.elemSize, shuf, packed);
+            if (packed.size() < b.raw.size()) { codec = SNAP_SHUFFLE_RLE; payload = packed.data(); stored = packed.size(); }
+        }
+        const uint32_t check = fnv1a(b.raw.data(), b.raw.size());
+        const uint64_t rawBytes = b.raw.size();
+        ok = std::fwrite(b.tag, 1, 4, f) == 4 && std::fwrite(&codec, 4, 1, f) == 1 &&
+             std::fwrite(&b.elemSize, 4, 1, f) == 1 && std::fwrite(&check, 4, 1, f) == 1 &&
+             std::fwrite(&rawBytes, 8, 1, f) == 1 && std::fwrite(&stored, 8, 1, f) == 1 &&
+             (stored == 0 || std::fwrite(payload, 1, (size_t)stored, f) == stored);
+        rawTotal += rawBytes; storedTotal += stored;
+    }
+    ok = (std::fclose(f) == 0) && ok;
+    if (ok && std::rename(tmp.c_str(), path.c_str()) != 0) {
+        std::remove(path.c_str());                       // platforms that won't rename over a file
+        ok = std::rename(tmp.c_str(), path.c_str()) == 0;
+    }
+    if (!ok) { std::fprintf(stderr, "snapshot: writing %s failed\n", path.c_str()); std::remove(tmp.c_str()); return false; }
+    st.rawBytes = rawTotal; st.storedBytes = storedTotal;
+    return true;
+}
+
+static bool readSnapshotFile(const std::string& path, SnapshotImage& img, std::string& err) {
+    FILE* f = std::fopen(path.c_str(), "rb");
+    if (!f) { err = "cannot open " + path; return false; }
+    std::unique_ptr<FILE, int(*)(FILE*)> close(f, std::fclose);
+    char magic[8];
+    uint32_t version = 0, count = 0;
+    if (std::fread(magic, 1, 8, f) != 8 || std::memcmp(magic, kSnapMagic, 8) ||
+        std::fread(&version, 4, 1, f) != 1 || std::fread(&count, 4, 1, f) != 1) { err = "not a snapshot"; return false; }
+    if (version != kSnapVersion) { err = "unsupported snapshot version " + std::to_string(version); return false; }
+    img.clear();
+    std::vector<uint8_t> stored, shuf;
+    for (uint32_t k=0; k<count; ++k) {
+        char tag[4];
+        uint32_t codec = 0, elem = 0, check = 0;
+        uint64_t rawBytes = 0, storedBytes = 0;
+        if (std::fread(tag, 1, 4, f) != 4 || std::fread(&codec, 4, 1, f) != 1 || std::fread(&elem, 4, 1, f) != 1 ||
+            std::fread(&check, 4, 1, f) != 1 || std::fread(&rawBytes, 8, 1, f) != 1 || std::fread(&storedBytes, 8, 1, f) != 1 ||
+            elem == 0 || rawBytes % elem || storedBytes > ((uint64_t)1 << 40)) { err = "truncated block header"; return false; }
+        SnapBlock& b = img.add(tag, elem);
+        stored.resize((size_t)storedBytes);
+        if (storedBytes && std::fread(stored.data(), 1, (size_t)storedBytes, f) != storedBytes) { err = "truncated block"; return false; }
+        if (codec == SNAP_RAW && storedBytes == rawBytes) b.raw.assign(stored.begin(), stored.end());
+        else if (codec != SNAP_SHUFFLE_RLE || !snapDecode(stored.data(), stored.size(), elem, (size_t)rawBytes, shuf, b.raw)) {
+            err = "bad block " + std::string(tag, 4); return false;
+        }
+        if (fnv1a(b.raw.data(), b.raw.size()) != check) { err = "checksum mismatch in " + std::string(tag, 4); return false; }
+    }
+    return true;
+}
+
+static const char* const kPuffTags[11] = { "P.x ", "P.y ", "P.r ", "P.vx", "P.vy", "P.gr", "P.wb", "P.lf", "P.ml", "P.wh", "P.id" };
+
+static void captureSnapshot(const Simulation& sim, SnapshotImage& img) {
+    img.clear();
+    std::vector<uint8_t>& s = img.add("SIM ", 1).raw;
+    snapPut(s, (int32_t)sim.winW); snapPut(s, (int32_t)sim.winH);
+    snapPut(s, sim.time); snapPut(s, sim.steps); snapPut(s, sim.breeze);
+    for (uint32_t v : sim.rng.s) snapPut(s, v);
+    const PuffField& P = sim.puffs;
+    snapPut(s, P.nextId); snapPut(s, (uint64_t)P.budget);
+    snapPut(s, P.stats); snapPut(s, sim.mergeStats);
+    snapPut(s, (uint32_t)sim.emitters.size());
+    for (size_t k=0; k<sim.emitters.size(); ++k) {
+        const Emitter& e = sim.emitters[k];
+        for (float v : { e.x0, e.x1, e.y, e.rate, e.growth, e.life, sim.emitterTimers[k] }) snapPut(s, v);
+    }
+    int c = 0;
+    P.forEachColumn([&](const auto& col) { snapColumn(img, kPuffTags[c++], col); });
+    if (sim.windOn) {
+        std::vector<uint8_t>& w = img.add("WIND", 1).raw;
+        snapPut(w, (int32_t)sim.wind.nx); snapPut(w, (int32_t)sim.wind.ny);
+        snapPut(w, sim.wind.projectStats);
+        snapColumn(img, "W.w ", sim.wind.w);
+        if (sim.wind.projectOn) snapColumn(img, "W.p ", sim.wind.poisson.solution());
+    }
+    if (sim.atmosOn) {
+        std::vector<uint8_t>& a = img.add("ATMS", 1).raw;
+        snapPut(a, (int32_t)sim.atmos.nx); snapPut(a, (int32_t)sim.atmos.ny); snapPut(a, sim.atmos.seeded);
+        snapColumn(img, "A.qv", sim.atmos.qv);
+        snapColumn(img, "A.th", sim.atmos.theta);
+        snapColumn(img, "A.qc", sim.atmos.qc);
+    }
+}
+
+// The simulation must already be configured with the options of the saved
+// run. A grid that is off, or sized differently, starts from rest instead.
+static bool restoreSnapshot(Simulation& sim, const SnapshotImage& img, std::string& err) {
+    const SnapBlock* b = img.find("SIM ");
+    if (!b) { err = "no SIM block"; return false; }
+    SnapReader r(b->raw);
+    const int w = r.get<int32_t>(), h = r.get<int32_t>();
+    const double time = r.get<double>();
+    const uint64_t steps = r.get<uint64_t>();
+    const float breeze = r.get<float>();
+    uint32_t rng[4];
+    for (uint32_t& v : rng) v = r.get<uint32_t>();
+    const uint32_t nextId = r.get<uint32_t>();
+    const uint64_t budget = r.get<uint64_t>();
+    const PoolStats poolStats = r.get<PoolStats>();
+    const MergeStats mergeStats = r.get<MergeStats>();
+    const uint32_t emitters = r.get<uint32_t>();
+    if (!r.ok || w <= 0 || h <= 0 || emitters != sim.emitters.size()) { err = "bad SIM block"; return false; }
+    sim.resize(w, h);
+    for (size_t k=0; k<emitters; ++k) {
+        Emitter& e = sim.emitters[k];
+        for (float* v : { &e.x0, &e.x1, &e.y, &e.rate, &e.growth, &e.life, &sim.emitterTimers[k] }) *v = r.get<float>();
+    }
+    if (!r.ok) { err = "bad SIM block"; return false; }
+
+    PuffField& P = sim.puffs;
+    const SnapBlock* xs = img.find(kPuffTags[0]);
+    const size_t n = xs ? xs->raw.size() / sizeof(float) : 0;
+    if ((size_t)budget > P.budget) P.setBudget((size_t)budget, P.overflow);
+    int c = 0;
+    bool ok = true;
+    P.forEachColumn([&](auto& col) { ok = snapLoadColumn(img, kPuffTags[c++], col, n) && ok; });
+    if (!ok) { err = "missing or ragged puff columns"; return false; }
+    P.nextId = nextId;
+    P.stats = poolStats;
+
+    sim.time = time; sim.steps = steps; sim.breeze = breeze;
+    std::memcpy(sim.rng.s, rng, sizeof(rng));
+    sim.mergeStats = mergeStats;
+
+    if ((b = img.find("WIND"))) {
+        SnapReader wr(b->raw);
+        const int nx = wr.get<int32_t>(), ny = wr.get<int32_t>();
+        const ProjectStats ps = wr.get<ProjectStats>();
+        const size_t cells = (size_t)sim.wind.nx * sim.wind.ny;
+        if (!sim.windOn) {
+            std::fprintf(stderr, "snapshot: this run has no wind grid; ignoring the saved one\n");
+        } else if (wr.ok && nx == sim.wind.nx && ny == sim.wind.ny && snapLoadColumn(img, "W.w ", sim.wind.w, cells)) {
+            sim.wind.projectStats = ps;
+            if (sim.wind.projectOn && !snapLoadColumn(img, "W.p ", sim.wind.poisson.solution(), cells)) sim.wind.poisson.reset();
+        } else {
+            std::fprintf(stderr, "snapshot: saved wind grid %dx%d does not match this run's; starting it from rest\n", nx, ny);
+            std::fill(sim.wind.w.begin(), sim.wind.w.end(), 0.f);
+        }
+    }
+    if ((b = img.find("ATMS"))) {
+        SnapReader ar(b->raw);
+        const int nx = ar.get<int32_t>(), ny = ar.get<int32_t>();
+        const uint64_t seeded = ar.get<uint64_t>();
+        const size_t cells = (size_t)sim.atmos.nx * sim.atmos.ny;
+        if (!sim.atmosOn) {
+            std::fprintf(stderr, "snapshot: this run has no atmosphere grid; ignoring the saved one\n");
+        } else if (ar.ok && nx == sim.atmos.nx && ny == sim.atmos.ny &&
+                   snapLoadColumn(img, "A.qv", sim.atmos.qv, cells) && snapLoadColumn(img, "A.th", sim.atmos.theta, cells) &&
+                   snapLoadColumn(img, "A.qc", sim.atmos.qc, cells)) {
+            sim.atmos.seeded = seeded;
+        } else {
+            std::fprintf(stderr, "snapshot: saved atmosphere %dx%d does not match this run's; starting it from the environment\n", nx, ny);
+            sim.atmos.init(sim.atmos.nx, sim.atmos.ny, sim.winW, sim.winH);
+        }
+    }
+    return true;
+}
+
+// Restores path into sim (configured for this run) and puts it back at the run's
+// window size if the snapshot was taken at another.
+static bool restoreFromFile(Simulation& sim, const std::string& path, int winW, int winH) {
+    SnapshotImage img;
+    std::string err;
+    if (!readSnapshotFile(path, img, err) || !restoreSnapshot(sim, img, err)) {
+        std::fprintf(stderr, "restore %s: %s\n", path.c_str(), err.c_str());
+        return false;
+    }
+    std::printf("restored %s: step %llu, t=%.2f s, %zu puffs\n", path.c_str(),
+                (unsigned long long)sim.steps, sim.time, sim.puffs.size());
+    if (sim.winW != winW || sim.winH != winH) {
+        std::printf("snapshot was %dx%d; resizing to %dx%d\n", sim.winW, sim.winH, winW, winH);
+        sim.resize(winW, winH);
+    }
+    return true;
+}
+
+// Captures on the simulation's thread (plain copies into a reused image), then
+// shuffles, compresses and writes on its own thread. If the last snapshot is
+// still being written, submit() skips this one rather than stall a step.
+class SnapshotWriter {
+public:
+    explicit SnapshotWriter(const std::string& path) : path_(path), th_([this]{ run(); }) {}
+    ~SnapshotWriter() {
+        { std::lock_guard<std::mutex> lk(m_); quit_ = true; }
+        cv_.notify_all();
+        th_.join();
+    }
+
+    bool submit(const Simulation& sim) {
+        {
+            std::lock_guard<std::mutex> lk(m_);
+            if (pending_) { ++stats_.skipped; return false; }
+        }
+        captureSnapshot(sim, img_);          // the writer only reads img_ while pending_
+        { std::lock_guard<std::mutex> lk(m_); pending_ = true; }
+        cv_.notify_all();
+        return true;
+    }
+    // Blocks until nothing is pending, then writes sim and waits for that too.
+    void writeNow(const Simulation& sim) {
+        flush();
+        submit(sim);
+        flush();
+    }
+    void flush() {
+        std::unique_lock<std::mutex> lk(m_);
+        cv_.wait(lk, [this]{ return !pending_; });
+    }
+    SnapStats stats() { std::lock_guard<std::mutex> lk(m_); return stats_; }
+    const std::string& path() const { return path_; }
+
+private:
+    void run() {
+        std::unique_lock<std::mutex> lk(m_);
+        for (;;) {
+            cv_.wait(lk, [this]{ return pending_ || quit_; });
+            if (!pending_) return;
+            lk.unlock();
+            SnapStats st;
+            const bool ok = writeSnapshotFile(path_, img_, shuf_, packed_, st);
+            lk.lock();
+            if (ok) { ++stats_.written; stats_.rawBytes = st.rawBytes; stats_.storedBytes = st.storedBytes; }
+            else ++stats_.failed;
+            pending_ = false;
+            cv_.notify_all();
+        }
+    }
+
+    std::string path_;
+    SnapshotImage img_;
+    std::vector<uint8_t> shuf_, packed_;
+    std::mutex m_;
+    std::condition_variable cv_;
+    bool pending_ = false, quit_ = false;
+    SnapStats stats_;
+    std::thread th_;                         // last: starts once everything above exists
+};
+
+// ---------- trajectories ----------
+// Per-step puff tracks for offline analysis, written at memcpy speed. Each
+// recorded step appends one frame to a memory-mapped file. The file is sized
+// ahead in large extents, so a step only copies columns and never makes a
+// system call unless an extent fills up. A companion index of frame offsets
+// gives any frame in O(1). Puffs keep their id for life (see PuffField), so
+// a track is every record with the same id. Note that --merge and --split end
+// and start tracks.
+//
+// FILE, little-endian:
+//   64-byte header: "CLDTRAJ\0", u32 version, u32 columns (6), u64 frames,
+//                   u64 bytes used, i32 width, i32 height, then zeros
+//   per frame, 8-byte aligned: u64 step, f64 time, u64 puff count n, then six
+//                   columns of n 4-byte values: id (u32), x, y, r, whiten, life (f32)
+// FILE.idx: one u64 byte offset into FILE per frame.
+// The header is rewritten after each frame and both files are trimmed on close.
+// A reader of a file cut short by a crash trusts only the frames the header
+// counts.
+static const uint32_t kTrajVersion = 1;
+static const char kTrajMagic[8] = { 'C','L','D','T','R','A','J','\0' };
+static const size_t kTrajHeader = 64, kTrajFrameHeader = 24, kTrajColumns = 6;
+
+struct TrajHeader {
+    char magic[8];
+    uint32_t version, columns;
+    uint64_t frames, used;
+    int32_t width, height;
+};
+static_assert(sizeof(TrajHeader) <= kTrajHeader, "header must fit its slot");
+
+// A file mapped read/write that grows by whole extents (munmap, ftruncate,
+// mmap again, so pointers into it last only until the next reserve()), or
+// mapped read-only. Writers go through offsets.
+class MappedFile {
+public:
+    MappedFile() = default;
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+    ~MappedFile() { close(); }
+
+    bool create(const std::string& path, size_t extent) {
+        close();
+        fd_ = ::open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+        if (fd_ < 0) return false;
+        writable_ = true;
+        extent_ = extent;
+        return reserve(extent);
+    }
+    bool openRead(const std::string& path) {
+        close();
+        fd_ = ::open(path.c_str(), O_RDONLY);
+        if (fd_ < 0) return false;
+        struct stat st;
+        if (fstat(fd_, &st) != 0) return false;
+        size_ = used_ = (size_t)st.st_size;
+        if (size_ == 0) return true;
+        void* p = mmap(nullptr, size_, PROT_READ, MAP_SHARED, fd_, 0);
+        if (p == MAP_FAILED) { size_ = used_ = 0; return false; }
+        base_ = (uint8_t*)p;
+        return true;
+    }
+    // Room for used() + bytes. Growth rounds up to the next extent.
+    bool reserve(size_t bytes) {
+        const size_t need = used_ + bytes;
+        if (need <= size_) return true;
+        const size_t grown = (need + extent_ - 1) / extent_ * extent_;
+        if (base_) munmap(base_, size_);
+        base_ = nullptr;
+        if (ftruncate(fd_, (off_t)grown) != 0) { size_ = 0; return false; }
+        void* p = mmap(nullptr, grown, PROT_READ | PROT_WRITE, MAP_SHARED, fd_, 0);
+        if (p == MAP_FAILED) { size_ = 0; return false; }
+        base_ = (uint8_t*)p;
+        size_ = grown;
+        ++extents_;
+        return true;
+    }
+    void commit(size_t bytes) { used_ += bytes; }
+    // Unmaps, and for a writer trims the file to what was committed.
+    void close() {
+        if (base_) munmap(base_, size_);
+        if (fd_ >= 0) {
+            if (writable_ && ftruncate(fd_, (off_t)used_) != 0)
+                std::fprintf(stderr, "trajectory: could not trim file to %zu bytes\n", used_);
+            ::close(fd_);
+        }
+        base_ = nullptr; fd_ = -1; size_ = used_ = 0; writable_ = false;
+    }
+
+    uint8_t* data() const { return base_; }
+    size_t used() const { return used_; }
+    uint64_t extents() const { return extents_; }
+
+private:
+    int fd_ = -1;
+    uint8_t* base_ = nullptr;
+    size_t size_ = 0, used_ = 0, extent_ = 1;
+    uint64_t extents_ = 0;
+    bool writable_ = false;
+};
+
+// Appends one frame per call on the simulation's thread. After a failed grow
+// (disk full, say) it stops recording and says so once. Frames already written
+// stay readable.
+class TrajectoryWriter {
+public:
+    bool open(const std::string& path, int width, int height) {
+        path_ = path;
+        if (!data_.create(path, kDataExtent) || !index_.create(path + ".idx", kIndexExtent)) {
+            std::fprintf(stderr, "trajectory: cannot map %s\n", path.c_str());
+            return false;
+        }
+        TrajHeader h;
+        std::memset(&h, 0, sizeof h);
+        std::memcpy(h.magic, kTrajMagic, 8);
+        h.version = kTrajVersion; h.columns = (uint32_t)kTrajColumns;
+        h.width = width; h.height = height;
+        std::memset(data_.data(), 0, kTrajHeader);
+        data_.commit(kTrajHeader);
+        header_ = h;
+        writeHeader();
+        ok_ = true;
+        return true;
+    }
+
+    void append(const Simulation& sim) {
+        if (!ok_) return;
+        const PuffField& P = sim.puffs;
+        const size_t n = P.size();
+        const size_t bytes = (kTrajFrameHeader + kTrajColumns*4*n + 7) & ~(size_t)7;
+        if (!data_.reserve(bytes) || !index_.reserve(8)) {
+            std::fprintf(stderr, "trajectory: cannot grow %s; recording stopped at %llu frames\n",
+                         path_.c_str(), (unsigned long long)header_.frames);
+            ok_ = false;
+            return;
+        }
+        const uint64_t at = data_.used();
+        uint8_t* p = data_.data() + at;
+        const uint64_t step = sim.steps, count = n;
+        std::memcpy(p, &step, 8); std::memcpy(p + 8, &sim.time, 8); std::memcpy(p + 16, &count, 8);
+        p += kTrajFrameHeader;
+        const void* cols[kTrajColumns] = { P.id.data(), P.x.data(), P.y.data(), P.r.data(), P.whiten.data(), P.life.data() };
+        for (const void* c : cols) { if (n) std::memcpy(p, c, 4*n); p += 4*n; }
+        std::memset(p, 0, data_.data() + at + bytes - p);
+        data_.commit(bytes);
+        std::memcpy(index_.data() + index_.used(), &at, 8);
+        index_.commit(8);
+        ++header_.frames;
+        header_.used = data_.used();
+        writeHeader();
+    }
+
+    void close() { data_.close(); index_.close(); }
+
+    uint64_t frames() const { return header_.frames; }
+    uint64_t bytes() const { return header_.used; }
+    uint64_t extents() const { return data_.extents() + index_.extents(); }
+    const std::string& path() const { return path_; }
+
+private:
+    static const size_t kDataExtent = (size_t)64 << 20;   // ~450 steps of 20000 puffs
+    static const size_t kIndexExtent = (size_t)1 << 20;   // 131072 frames
+
+    void writeHeader() { std::memcpy(data_.data(), &header_, sizeof header_); }
+
+    MappedFile data_, index_;
+    TrajHeader header_{};
+    std::string path_;
+    bool ok_ = false;
+};
+
+// One frame of a trajectory file. The pointers point into the reader's mapping.
+struct TrajectoryFrame {
+    uint64_t step;
+    double time;
+    size_t n;
+    const uint32_t* id;
+    const float *x, *y, *r, *whiten, *life;
+};
+
+class TrajectoryReader {
+public:
+    bool open(const std::string& path, std::string& err) {
+        if (!data_.openRead(path)) { err = "cannot map " + path; return false; }
+        if (!index_.openRead(path + ".idx")) { err = "cannot map " + path + ".idx"; return false; }
+        if (data_.used() < kTrajHeader) { err = "not a trajectory file"; return false; }
+        std::memcpy(&header_, data_.data(), sizeof header_);
+        if (std::memcmp(header_.magic, kTrajMagic, 8)) { err = "not a trajectory file"; return false; }
+        if (header_.version != kTrajVersion || header_.columns != kTrajColumns) {
+            err = "unsupported trajectory version " + std::to_string(header_.version); return false;
+        }
+        if (header_.used > data_.used()) { err = "trajectory file is shorter than its header says"; return false; }
+        frames_ = std::min<size_t>((size_t)header_.frames, index_.used() / 8);
+        return true;
+    }
+
+    size_t frames() const { return frames_; }
+    int width() const { return header_.width; }
+    int height() const { return header_.height; }
+    uint64_t bytes() const { return header_.used; }
+
+    // False when k is out of range or its frame runs past the data.
+    bool frame(size_t k, TrajectoryFrame& f) const {
+        if (k >= frames_) return false;
+        uint64_t at, count;
+        std::memcpy(&at, index_.data() + 8*k, 8);
+        if (at < kTrajHeader || (at & 7) || at + kTrajFrameHeader > header_.used) return false;
+        const uint8_t* p = data_.data() + at;
+        std::memcpy(&f.step, p, 8); std::memcpy(&f.time, p + 8, 8); std::memcpy(&count, p + 16, 8);
+        if (count > (header_.used - at - kTrajFrameHeader) / (4*kTrajColumns)) return false;
+        f.n = (size_t)count;
+        const float* c = (const float*)(p + kTrajFrameHeader);
+        f.id = (const uint32_t*)c;
+        f.x = c + f.n; f.y = c + 2*f.n; f.r = c + 3*f.n; f.whiten = c + 4*f.n; f.life = c + 5*f.n;
+        return true;
+    }
+
+private:
+    MappedFile data_, index_;
+    TrajHeader header_{};
+    size_t frames_ = 0;
+};
+
+// --read-trajectory=FILE[@K]: file summary, frame K (default the last), and
+// how long the track of that frame's first puff runs. The track search
+// walks frames outward from K, stopping at the first frame without the id.
+static int runTrajectoryReport(const std::string& arg) {
+    std::string path = arg;
+    long pick = -1;
+    const size_t at = arg.rfind('@');
+    if (at != std::string::npos) { path = arg.substr(0, at); pick = std::atol(arg.c_str() + at + 1); }
+    TrajectoryReader rd;
+    std::string err;
+    if (!rd.open(path, err)) { std::fprintf(stderr, "trajectory %s: %s\n", path.c_str(), err.c_str()); return 1; }
+    std::printf("%s: %zu frames of a %dx%d domain, %.1f MB\n", path.c_str(), rd.frames(), rd.width(), rd.height(),
+                rd.bytes() / 1048576.0);
+    if (rd.frames() == 0) return 0;
+    const size_t k = pick < 0 ? rd.frames() - 1 : (size_t)pick;
+    TrajectoryFrame f;
+    if (!rd.frame(k, f)) { std::fprintf(stderr, "trajectory %s: no frame %zu\n", path.c_str(), k); return 1; }
+    double sy = 0.0, sr = 0.0;
+    for (size_t i=0; i<f.n; ++i) { sy += f.y[i]; sr += f.r[i]; }
+    std::printf("frame %zu: step %llu, t=%.2f s, %zu puffs, mean altitude %.1f px, mean radius %.1f px\n", k,
+                (unsigned long long)f.step, f.time, f.n, f.n ? sy / f.n : 0.0, f.n ? sr / f.n : 0.0);
+    if (f.n == 0) return 0;
+    const uint32_t id = f.id[0];
+    auto has = [&](size_t j, float& y) {
+        TrajectoryFrame g;
+        if (!rd.frame(j, g)) return false;
+        for (size_t i=0; i<g.n; ++i) if (g.id[i] == id) { y = g.y[i]; return true; }
+        return false;
+    };
+    size_t first = k, last = k;
+    float y0 = f.y[0], y1 = f.y[0], y;
+    while (first > 0 && has(first - 1, y)) { --first; y0 = y; }
+    while (last + 1 < rd.frames() && has(last + 1, y)) { ++last; y1 = y; }
+    std::printf("puff %u: frames %zu..%zu, altitude %.1f → %.1f px\n", id, first, last, y0, y1);
+    return 0;
+}
+
+// ---------- batched renderer ----------
+// All rings of all blobs go into one interleaved position+color triangle list.
+// ES 1.1 only guarantees 16-bit indices, so the list is cut into chunks of at
+// most 65536 vertices; each chunk is one glDrawElements.
+enum RenderBackend { RENDER_IMMEDIATE, RENDER_BATCHED, RENDER_SPLAT, RENDER_SPRITE, RENDER_COUNT };
+static const char* const kRenderNames[RENDER_COUNT] = { "immediate", "batched", "splat", "sprite" };
+static RenderBackend g_render = RENDER_IMMEDIATE;
+
+struct BatchVertex {
+    GLfloat x, y;
+    GLfloat r, g, b, a;
+};
+
+template <class Vertex>
+struct IndexedBatch {
+    struct Chunk { size_t firstVert, firstIdx, idxCount; };
+    std::vector<Vertex>      verts;
+    std::vector<GLushort>    idx;     // relative to the owning chunk's firstVert
+    std::vector<Chunk>       chunks;
+
+    void clear() { verts.clear(); idx.clear(); chunks.clear(); }
+
+    // Start a new chunk if nv more vertices would overflow 16-bit indices.
+    GLushort reserveVerts(size_t nv) {
+        if (chunks.empty() || verts.size() - chunks.back().firstVert + nv > 65536)
+            chunks.push_back({ verts.size(), idx.size(), 0 });
+        return (GLushort)(verts.size() - chunks.back().firstVert);
+    }
+    size_t chunkVerts(size_t k) const {
+        return (k+1 < chunks.size() ? chunks[k+1].firstVert : verts.size()) - chunks[k].firstVert;
+    }
+    void addIndices(const GLushort* pattern, size_t n, GLushort base) {
+        for (size_t i=0; i<n; ++i) idx.push_back((GLushort)(base + pattern[i]));
+        chunks.back().idxCount += n;
+    }
+};
+using TriBatch = IndexedBatch<BatchVertex>;
+
+// Fan (center + slices+1 rim points) expanded to an indexed triangle list.
+static const std::vector<GLushort>& fanIndices(int slices) {
+    static std::map<int, std::vector<GLushort>> cache;
+    auto it = cache.find(slices);
+    if (it != cache.end()) return it->second;
+    std::vector<GLushort>& ix = cache[slices];
+    for (int s=0; s<slices; ++s) {
+        ix.push_back(0); ix.push_back((GLushort)(1+s)); ix.push_back((GLushort)(2+s));
+    }
+    return ix;
+}
+
+static void appendSoftBlob(TriBatch& B, GLfloat cx, GLfloat cy, GLfloat R,
+                           const GLfloat rgb[3], float alphaPeak, int rings) {
+    const UnitCircle&  uc = unitCircle(kBlobSlices);
+    const RingProfile& rp = ringProfile(rings);
+    const std::vector<GLushort>& fan = fanIndices(uc.slices);
+    const GLfloat* cs = uc.cs.data();
+    for (int i=0; i<rings; ++i) {
+        const GLfloat r = rp.t[i]*R;
+        const GLfloat a = alphaPeak * rp.fall[i];
+        GLushort base = B.reserveVerts((size_t)uc.slices + 2);
+        B.verts.push_back({ cx, cy, rgb[0], rgb[1], rgb[2], a });
+        for (int s=0; s<=uc.slices; ++s)
+            B.verts.push_back({ cx + r*cs[2*s+0], cy + r*cs[2*s+1], rgb[0], rgb[1], rgb[2], a });
+        B.addIndices(fan.data(), fan.size(), base);
+    }
+}
+
+static void appendClouds(TriBatch& B, const PuffView& P) {
+    for (size_t i=0; i<P.n; ++i) {
+        GLfloat rgb[3];
+        float peak = puffTint(P.whiten[i], P.r[i], rgb);
+        appendSoftBlob(B, P.x[i], P.y[i], P.r[i], rgb, peak, kPuffRings);
+    }
+}
+
+static void drawBatch(const TriBatch& B) {
+    if (B.idx.empty()) return;
+    glEnableClientState(GL_VERTEX_ARRAY);
+    glEnableClientState(GL_COLOR_ARRAY);
+    for (size_t k=0; k<B.chunks.size(); ++k) {
+        const auto& c = B.chunks[k];
+        const char* v = streamVerts(B.verts.data() + c.firstVert, B.chunkVerts(k)*sizeof(BatchVertex));
+        glVertexPointer(2, GL_FLOAT, sizeof(BatchVertex), v + offsetof(BatchVertex, x));
+        glColorPointer (4, GL_FLOAT, sizeof(BatchVertex), v + offsetof(BatchVertex, r));
+        glDrawElements(GL_TRIANGLES, (GLsizei)c.idxCount, GL_UNSIGNED_SHORT,
+                       streamIndices(B.idx.data() + c.firstIdx, c.idxCount));
+    }
+    streamDone();
+    glDisableClientState(GL_COLOR_ARRAY);
+    glDisableClientState(GL_VERTEX_ARRAY);
+}
+
+// ---------- splat renderer ----------
+// One textured quad per blob instead of `rings` overdrawn fans, so every covered
+// pixel is blended once. The alpha texture holds the composite of the ring stack,
+// 1 - Π(1 - peak*fall_i) over the rings reaching each radius, normalised to 1 at
+// the center; the vertex alpha is the stack's exact center value and GL_MODULATE
+// multiplies the two. The shape is taken at kSplatRefPeak; at other peaks the
+// only difference is the slight nonlinearity of stacked blending.
+static const int   kSplatTexSize = 128;
+static const float kSplatRefPeak = 0.2f;
+
+struct SplatVertex {
+    GLfloat x, y;
+    GLfloat u, v;
+    GLfloat r, g, b, a;
+};
+using SplatBatch = IndexedBatch<SplatVertex>;
+
+static float ringStackAlpha(const RingProfile& rp, float peak, float rho) {
+    float keep = 1.f;
+    for (int i=0; i<rp.rings; ++i)
+        if (rp.t[i] >= rho) keep *= 1.f - peak*rp.fall[i];
+    return 1.f - keep;
+}
+
+// Texture object for a ring count, uploaded on first use (needs a current context).
+static GLuint splatTexture(int rings) {
+    static std::map<int, GLuint> cache;
+    auto it = cache.find(rings);
+    if (it != cache.end()) return it->second;
+    const RingProfile& rp = ringProfile(rings);
+    const float center = ringStackAlpha(rp, kSplatRefPeak, 0.f);
+    const int N = kSplatTexSize, kSub = 4;   // 4×4 samples per texel smooth the ring steps' aliasing
+    std::vector<GLubyte> texels((size_t)N*N);
+    for (int y=0; y<N; ++y)
+        for (int x=0; x<N; ++x) {
+            float sum = 0.f;
+            for (int sy=0; sy<kSub; ++sy)
+                for (int sx=0; sx<kSub; ++sx) {
+                    float u = (x + (sx+0.5f)/kSub) * 2.f/N - 1.f;
+                    float v = (y + (sy+0.5f)/kSub) * 2.f/N - 1.f;
+                    float rho = std::sqrt(u*u + v*v);
+                    if (rho <= 1.f) sum += ringStackAlpha(rp, kSplatRefPeak, rho);
+                }
+            texels[(size_t)y*N + x] = (GLubyte)(clampf(sum / (kSub*kSub) / center, 0.f, 1.f)*255.f + 0.5f);
+        }
+    GLuint tex = 0;
+    glGenTextures(1, &tex);
+    glBindTexture(GL_TEXTURE_2D, tex);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_ALPHA, N, N, 0, GL_ALPHA, GL_UNSIGNED_BYTE, texels.data());
+    cache[rings] = tex;
+    return tex;
+}
+
+static void appendSplat(SplatBatch& B, GLfloat cx, GLfloat cy, GLfloat R,
+                        const GLfloat rgb[3], float alphaPeak, int rings) {
+    static const GLushort quad[6] = {0,1,2, 0,2,3};
+    const GLfloat a = ringStackAlpha(ringProfile(rings), alphaPeak, 0.f);
+    GLushort base = B.reserveVerts(4);
+    B.verts.push_back({ cx-R, cy-R, 0.f, 0.f, rgb[0], rgb[1], rgb[2], a });
+    B.verts.push_back({ cx+R, cy-R, 1.f, 0.f, rgb[0], rgb[1], rgb[2], a });
+    B.verts.push_back({ cx+R, cy+R, 1.f, 1.f, rgb[0], rgb[1], rgb[2], a });
+    B.verts.push_back({ cx-R, cy+R, 0.f, 1.f, rgb[0], rgb[1], rgb[2], a });
+    B.addIndices(quad, 6, base);
+}
+static void appendSplatClouds(SplatBatch& B, const PuffView& P) {
+    for (size_t i=0; i<P.n; ++i) {
+        GLfloat rgb[3];
+        float peak = puffTint(P.whiten[i], P.r[i], rgb);
+        appendSplat(B, P.x[i], P.y[i], P.r[i], rgb, peak, kPuffRings);
+    }
+}
+static void drawSplatBatch(const SplatBatch& B, GLuint tex) {
+    if (B.idx.empty()) return;
+    glEnable(GL_TEXTURE_2D);
+    glBindTexture(GL_TEXTURE_2D, tex);
+    glEnableClientState(GL_VERTEX_ARRAY);
+    glEnableClientState(GL_TEXTURE_COORD_ARRAY);
+    glEnableClientState(GL_COLOR_ARRAY);
+    for (size_t k=0; k<B.chunks.size(); ++k) {
+        const auto& c = B.chunks[k];
+        const char* v = streamVerts(B.verts.data() + c.firstVert, B.chunkVerts(k)*sizeof(SplatVertex));
+        glVertexPointer  (2, GL_FLOAT, sizeof(SplatVertex), v + offsetof(SplatVertex, x));
+        glTexCoordPointer(2, GL_FLOAT, sizeof(SplatVertex), v + offsetof(SplatVertex, u));
+        glColorPointer   (4, GL_FLOAT, sizeof(SplatVertex), v + offsetof(SplatVertex, r));
+        glDrawElements(GL_TRIANGLES, (GLsizei)c.idxCount, GL_UNSIGNED_SHORT,
+                       streamIndices(B.idx.data() + c.firstIdx, c.idxCount));
+    }
+    streamDone();
+    glDisableClientState(GL_COLOR_ARRAY);
+    glDisableClientState(GL_TEXTURE_COORD_ARRAY);
+    glDisableClientState(GL_VERTEX_ARRAY);
+    glDisable(GL_TEXTURE_2D);
+}
+
+// Point sprites (GL_OES_point_sprite + GL_OES_point_size_array): one vertex per
+// puff carrying position, diameter and color, textured with the splat falloff.
+// Points are capped at the driver's maximum size and, under ES 1.1, culled whole
+// once the center leaves the viewport; those puffs are drawn as splat quads after
+// the sprites, which changes the blend order for them only.
+struct SpriteVertex {
+    GLfloat x, y;
+    GLfloat size;
+    GLfloat r, g, b, a;
+};
+
+struct PointSpriteCaps {
+    bool    supported = false;
+    GLfloat maxSize = 0.f;   // 0 when unsupported: every puff takes the quad path
+};
+static PointSpriteCaps g_sprites;
+
+static bool hasExtension(const char* list, const char* name) {
+    const size_t n = std::strlen(name);
+    for (const char* p = list; p && (p = std::strstr(p, name)); p += n)
+        if ((p == list || p[-1] == ' ') && (p[n] == ' ' || p[n] == '\0')) return true;
+    return false;
+}
+
+// Needs a current context.
+static PointSpriteCaps detectPointSprites() {
+    PointSpriteCaps caps;
+    const char* ext = (const char*)glGetString(GL_EXTENSIONS);
+    if (!hasExtension(ext, "GL_OES_point_sprite") || !hasExtension(ext, "GL_OES_point_size_array"))
+        return caps;
+    GLfloat range[2] = { 0.f, 0.f };
+    glGetFloatv(GL_ALIASED_POINT_SIZE_RANGE, range);
+    caps.supported = range[1] > 1.f;
+    caps.maxSize = caps.supported ? range[1] : 0.f;
+    return caps;
+}
+
+static void appendSpriteClouds(std::vector<SpriteVertex>& S, SplatBatch& Q, const PuffView& P,
+                               int winW, int winH, GLfloat maxSize) {
+    const RingProfile& rp = ringProfile(kPuffRings);
+    for (size_t i=0; i<P.n; ++i) {
+        GLfloat rgb[3];
+        float peak = puffTint(P.whiten[i], P.r[i], rgb);
+        const GLfloat d = 2.f*P.r[i];
+        const bool inside = P.x[i] >= 0.f && P.x[i] <= winW && P.y[i] >= 0.f && P.y[i] <= winH;
+        if (d <= maxSize && inside)
+            S.push_back({ P.x[i], P.y[i], d, rgb[0], rgb[1], rgb[2],
+                          ringStackAlpha(rp, peak, 0.f) });
+        else
+            appendSplat(Q, P.x[i], P.y[i], P.r[i], rgb, peak, kPuffRings);
+    }
+}
+static void drawSpriteBatch(const std::vector<SpriteVertex>& S, GLuint tex) {
+    if (S.empty()) return;
+    glEnable(GL_TEXTURE_2D);
+    glBindTexture(GL_TEXTURE_2D, tex);
+    glEnable(GL_POINT_SPRITE_OES);
+    glTexEnvi(GL_POINT_SPRITE_OES, GL_COORD_REPLACE_OES, GL_TRUE);
+    glEnableClientState(GL_VERTEX_ARRAY);
+    glEnableClientState(GL_COLOR_ARRAY);
+    glEnableClientState(GL_POINT_SIZE_ARRAY_OES);
+    const char* v = streamVerts(S.data(), S.size()*sizeof(SpriteVertex));
+    glVertexPointer      (2, GL_FLOAT, sizeof(SpriteVertex), v + offsetof(SpriteVertex, x));
+    glColorPointer       (4, GL_FLOAT, sizeof(SpriteVertex), v + offsetof(SpriteVertex, r));
+    glPointSizePointerOES(GL_FLOAT, sizeof(SpriteVertex), v + offsetof(SpriteVertex, size));
+    glDrawArrays(GL_POINTS, 0, (GLsizei)S.size());
+    streamDone();
+    glDisableClientState(GL_POINT_SIZE_ARRAY_OES);
+    glDisableClientState(GL_COLOR_ARRAY);
+    glDisableClientState(GL_VERTEX_ARRAY);
+    glDisable(GL_POINT_SPRITE_OES);
+    glDisable(GL_TEXTURE_2D);
+}
+
+// ---------- scene ----------
+// Palette and layout shared by drawScene and the software backend.
+static const GLfloat kSkyTop[4]  = {0.42f, 0.66f, 0.95f, 1.f};
+static const GLfloat kSkyMid[4]  = {0.62f, 0.78f, 0.98f, 1.f};
+static const GLfloat kSkyNear[4] = {0.78f, 0.86f, 0.99f, 1.f};
+static const GLfloat kGround[4]  = {0.40f, 0.55f, 0.35f, 1.f};
+static const GLfloat kHill1[4]   = {0.33f, 0.47f, 0.32f, 1.f};
+static const GLfloat kHill2[4]   = {0.28f, 0.42f, 0.30f, 1.f};
+static const GLfloat kSunRGB[3]  = {1.0f, 0.98f, 0.88f};
+
+// Vertex-colored rectangle as two triangles, same corners and split as fillRectGradient.
+static void appendRect(TriBatch& B, GLfloat x, GLfloat y, GLfloat w, GLfloat h,
+                       const GLfloat c00[4], const GLfloat c10[4],
+                       const GLfloat c11[4], const GLfloat c01[4]) {
+    static const GLushort quad[6] = {0,1,2, 0,2,3};
+    GLushort base = B.reserveVerts(4);
+    B.verts.push_back({ x,   y,   c00[0], c00[1], c00[2], c00[3] });
+    B.verts.push_back({ x+w, y,   c10[0], c10[1], c10[2], c10[3] });
+    B.verts.push_back({ x+w, y+h, c11[0], c11[1], c11[2], c11[3] });
+    B.verts.push_back({ x,   y+h, c01[0], c01[1], c01[2], c01[3] });
+    B.addIndices(quad, 6, base);
+}
+
+// Sky (first 12 indices), then ground and hills (next 18), in drawScene's order.
+static void appendBackground(TriBatch& B, int winW, int winH) {
+    appendRect(B, 0, winH*0.45f, (GLfloat)winW, winH*0.55f, kSkyTop, kSkyTop, kSkyMid, kSkyMid);
+    appendRect(B, 0, 0, (GLfloat)winW, winH*0.45f, kSkyMid, kSkyMid, kSkyNear, kSkyNear);
+    appendRect(B, 0, 0, (GLfloat)winW, 110.f, kGround, kGround, kGround, kGround);
+    appendRect(B, 0, 110.f, (GLfloat)winW, 18.f, kHill1, kHill1, kHill1, kHill1);
+    appendRect(B, 0, 128.f, (GLfloat)winW, 12.f, kHill2, kHill2, kHill2, kHill2);
+}
+static const GLsizei kSkyIndices = 12, kGroundIndices = 18;
+
+// Clouds and sun haze: everything in drawScene that is drawn over the background.
+static void appendForeground(TriBatch& B, const PuffView& clouds, int winW, int winH) {
+    appendClouds(B, clouds);
+    appendSoftBlob(B, winW*0.82f, winH*0.80f, 60.f, kSunRGB, 0.06f, 10);
+}
+
+// The full drawScene frame (sky, ground, hills, clouds, sun haze) as one batch.
+static void appendScene(TriBatch& B, const PuffView& clouds, int winW, int winH) {
+    appendBackground(B, winW, winH);
+    appendForeground(B, clouds, winW, winH);
+}
+
+// Background in a static VBO pair, uploaded once per window size.
+struct StaticBackground {
+    GLuint vbo = 0, ibo = 0;
+
+    void build(int winW, int winH) {
+        TriBatch B;
+        appendBackground(B, winW, winH);
+        if (!vbo) { glGenBuffers(1, &vbo); glGenBuffers(1, &ibo); }
+        glBindBuffer(GL_ARRAY_BUFFER, vbo);
+        glBufferData(GL_ARRAY_BUFFER, (GLsizeiptr)(B.verts.size()*sizeof(BatchVertex)), B.verts.data(), GL_STATIC_DRAW);
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ibo);
+        glBufferData(GL_ELEMENT_ARRAY_BUFFER, (GLsizeiptr)(B.idx.size()*sizeof(GLushort)), B.idx.data(), GL_STATIC_DRAW);
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+    }
+    // Draws `count` indices starting at `first`.
+    void draw(GLsizei first, GLsizei count) const {
+        const char* v = nullptr;
+        glBindBuffer(GL_ARRAY_BUFFER, vbo);
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ibo);
+        glEnableClientState(GL_VERTEX_ARRAY);
+        glEnableClientState(GL_COLOR_ARRAY);
+        glVertexPointer(2, GL_FLOAT, sizeof(BatchVertex), v + offsetof(BatchVertex, x));
+        glColorPointer (4, GL_FLOAT, sizeof(BatchVertex), v + offsetof(BatchVertex, r));
+        glDrawElements(GL_TRIANGLES, count, GL_UNSIGNED_SHORT, v + first*sizeof(GLushort));
+        glDisableClientState(GL_COLOR_ARRAY);
+        glDisableClientState(GL_VERTEX_ARRAY);
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+    }
+};
+
+// Sky, ground and hills only change on resize. With --bg-cache they are drawn
+// once, copied out of the back buffer into a texture (ES 1.1 has no FBOs, so
+// glCopyTexSubImage2D it is) and redrawn as one unblended full-screen quad.
+// Textures are power-of-two sized; the quad samples the w×h corner texel for pixel.
+struct BackgroundCache {
+    GLuint tex = 0;
+    int texW = 0, texH = 0, w = 0, h = 0;
+    bool valid = false;
+
+    void invalidate() { valid = false; }
+
+    // Copies the current back buffer; call right after the background is drawn.
+    // Returns false (and stays invalid) when the window exceeds GL_MAX_TEXTURE_SIZE.
+    bool capture(int winW, int winH) {
+        int tw = 1, th = 1;
+        while (tw < winW) tw *= 2;
+        while (th < winH) th *= 2;
+        GLint maxSize = 0;
+        glGetIntegerv(GL_MAX_TEXTURE_SIZE, &maxSize);
+        if (tw > maxSize || th > maxSize) return false;
+        if (!tex) glGenTextures(1, &tex);
+        glBindTexture(GL_TEXTURE_2D, tex);
+        if (tw != texW || th != texH) {
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+            glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, tw, th, 0, GL_RGB, GL_UNSIGNED_BYTE, nullptr);
+            texW = tw; texH = th;
+        }
+        glCopyTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, 0, 0, winW, winH);
+        w = winW; h = winH;
+        valid = true;
+        return true;
+    }
+
+    void blit() const {
+        const GLfloat u = (GLfloat)w / texW, v = (GLfloat)h / texH;
+        const GLfloat verts[] = { 0.f, 0.f,  (GLfloat)w, 0.f,  (GLfloat)w, (GLfloat)h,  0.f, (GLfloat)h };
+        const GLfloat uvs[]   = { 0.f, 0.f,  u, 0.f,  u, v,  0.f, v };
+        const GLushort idx[]  = {0,1,2, 0,2,3};
+        glDisable(GL_BLEND);
+        glEnable(GL_TEXTURE_2D);
+        glBindTexture(GL_TEXTURE_2D, tex);
+        glColor4f(1.f, 1.f, 1.f, 1.f);
+        glEnableClientState(GL_VERTEX_ARRAY);
+        glEnableClientState(GL_TEXTURE_COORD_ARRAY);
+        glVertexPointer  (2, GL_FLOAT, 0, streamVerts(verts, sizeof verts));
+        glTexCoordPointer(2, GL_FLOAT, 0, streamVerts(uvs, sizeof uvs));
+        glDrawElements(GL_TRIANGLES, 6, GL_UNSIGNED_SHORT, streamIndices(idx, 6));
+        streamDone();
+        glDisableClientState(GL_TEXTURE_COORD_ARRAY);
+        glDisableClientState(GL_VERTEX_ARRAY);
+        glDisable(GL_TEXTURE_2D);
+        glEnable(GL_BLEND);
+    }
+};
+
+// ---------- software rasterizer ----------
+// CPU backend for machines with no GPU or display. It follows GL's conventions:
+// pixel centers at +0.5, origin bottom-left, and GL_SRC_ALPHA /
+// GL_ONE_MINUS_SRC_ALPHA applied to all four channels. The framebuffer is float,
+// so it skips the 8-bit rounding a GPU does between blends. An edge shared by two
+// triangles belongs to exactly one of them, so fans blend each pixel once, as on
+// hardware. Triangles are binned into 64×64 tiles, and each tile renders its bin
+// in submission order on the TaskPool.
+struct SoftFramebuffer {
+    int w = 0, h = 0;
+    AlignedVec<float> px;   // RGBA float, row 0 at the bottom
+
+    void resize(int W, int H) { w = W; h = H; px.resize((size_t)W*H*4); }
+
+    // 8-bit RGB, top row first (image order).
+    void toRGB8(uint8_t* out) const {
+        for (int y=0; y<h; ++y) {
+            const float* src = &px[(size_t)(h-1-y)*w*4];
+            for (int x=0; x<w; ++x, src += 4, out += 3)
+                for (int k=0; k<3; ++k) out[k] = (uint8_t)(clampf(src[k], 0.f, 1.f)*255.f + 0.5f);
+        }
+    }
+    bool writePPM(const char* path) const {
+        FILE* f = std::fopen(path, "wb");
+        if (!f) { std::fprintf(stderr, "soft: cannot write %s\n", path); return false; }
+        std::vector<uint8_t> rgb((size_t)w*h*3);
+        toRGB8(rgb.data());
+        std::fprintf(f, "P6\n%d %d\n255\n", w, h);
+        bool ok = std::fwrite(rgb.data(), 1, rgb.size(), f) == rgb.size();
+        return std::fclose(f) == 0 && ok;
+    }
+};
+
+class SoftRenderer {
+public:
+    enum { kTile = 64 };
+
+    // Each tile starts from `base` when given (a cached background the size of
+    // fb), otherwise from the clear color.
+    void render(const TriBatch& B, SoftFramebuffer& fb, const float clear[4], TaskPool* pool,
+                const SoftFramebuffer* base = nullptr) {
+        setup(B, fb, pool);
+        bin(fb);
+        const int tilesX = (fb.w + kTile - 1) / kTile;
+        auto tile = [&](size_t t, int) {
+            const int tx0 = (int)(t % tilesX) * kTile, ty0 = (int)(t / tilesX) * kTile;
+            const int tx1 = std::min(fb.w, tx0 + kTile), ty1 = std::min(fb.h, ty0 + kTile);
+            for (int y=ty0; y<ty1; ++y) {
+                float* d = &fb.px[((size_t)y*fb.w + tx0)*4];
+                if (base) { std::memcpy(d, &base->px[((size_t)y*fb.w + tx0)*4], sizeof(float)*4*(tx1 - tx0)); continue; }
+                for (int x=tx0; x<tx1; ++x, d += 4) { d[0] = clear[0]; d[1] = clear[1]; d[2] = clear[2]; d[3] = clear[3]; }
+            }
+            for (uint32_t i : bins_[t]) drawTri(tris_[i], fb, tx0, ty0, tx1, ty1);
+        };
+        if (pool) pool->parallelFor(bins_.size(), tile);
+        else for (size_t t=0; t<bins_.size(); ++t) tile(t, 0);
+    }
+
+private:
+    struct Tri {
+        float a[3], b[3], c[3];     // edge i: a*x + b*y + c >= 0 inside
+        bool  incl[3];              // owns pixels lying exactly on the edge
+        int   x0, y0, x1, y1;       // covered pixel bbox, inclusive, clipped
+        float col[4], dx[4], dy[4]; // color plane: col + dx*x + dy*y
+        bool  flat, empty;
+    };
+
+    void setup(const TriBatch& B, const SoftFramebuffer& fb, TaskPool* pool) {
+        tris_.resize(B.idx.size() / 3);
+        chunkOf_.resize(B.chunks.size() + 1);
+        for (size_t k=0; k<B.chunks.size(); ++k) chunkOf_[k] = B.chunks[k].firstIdx / 3;
+        chunkOf_[B.chunks.size()] = tris_.size();
+        const size_t kSetupChunk = 4096;
+        auto work = [&](size_t c, int) {
+            size_t lo = c*kSetupChunk, hi = std::min(tris_.size(), lo + kSetupChunk);
+            size_t k = std::upper_bound(chunkOf_.begin(), chunkOf_.end(), lo) - chunkOf_.begin() - 1;
+            for (size_t i=lo; i<hi; ++i) {
+                while (i >= chunkOf_[k+1]) ++k;
+                const BatchVertex* v = B.verts.data() + B.chunks[k].firstVert;
+                const GLushort* ix = &B.idx[i*3];
+                setupTri(tris_[i], v[ix[0]], v[ix[1]], v[ix[2]], fb.w, fb.h);
+            }
+        };
+        size_t chunks = (tris_.size() + kSetupChunk - 1) / kSetupChunk;
+        if (pool) pool->parallelFor(chunks, work);
+        else for (size_t c=0; c<chunks; ++c) work(c, 0);
+    }
+
+    static void setupTri(Tri& T, BatchVertex p0, BatchVertex p1, BatchVertex p2, int W, int H) {
+        float area = (p1.x-p0.x)*(p2.y-p0.y) - (p2.x-p0.x)*(p1.y-p0.y);
+        T.empty = !(area != 0.f);
+        if (T.empty) return;
+        if (area < 0.f) { std::swap(p1, p2); area = -area; }   // counter-clockwise from here on
+        const BatchVertex* P[3] = { &p0, &p1, &p2 };
+        for (int e=0; e<3; ++e) {
+            const BatchVertex& u = *P[e];
+            const BatchVertex& v = *P[(e+1)%3];
+            // Written so the reversed edge of a neighbour gets exactly the negated coefficients.
+            T.a[e] = u.y - v.y;
+            T.b[e] = v.x - u.x;
+            T.c[e] = u.x*v.y - v.x*u.y;
+            T.incl[e] = T.a[e] > 0.f || (T.a[e] == 0.f && T.b[e] > 0.f);
+        }
+        float minx = std::min(p0.x, std::min(p1.x, p2.x)), maxx = std::max(p0.x, std::max(p1.x, p2.x));
+        float miny = std::min(p0.y, std::min(p1.y, p2.y)), maxy = std::max(p0.y, std::max(p1.y, p2.y));
+        T.x0 = std::max(0, (int)std::ceil(clampf(minx, -1.f, (float)W) - 0.5f));
+        T.x1 = std::min(W-1, (int)std::floor(clampf(maxx, -1.f, W + 1.f) - 0.5f));
+        T.y0 = std::max(0, (int)std::ceil(clampf(miny, -1.f, (float)H) - 0.5f));
+        T.y1 = std::min(H-1, (int)std::floor(clampf(maxy, -1.f, H + 1.f) - 0.5f));
+        if (T.x0 > T.x1 || T.y0 > T.y1) { T.empty = true; return; }
+        const float c0[4] = { p0.r, p0.g, p0.b, p0.a };
+        const float c1[4] = { p1.r, p1.g, p1.b, p1.a };
+        const float c2[4] = { p2.r, p2.g, p2.b, p2.a };
+        T.flat = !std::memcmp(c0, c1, sizeof c0) && !std::memcmp(c0, c2, sizeof c0);
+        for (int k=0; k<4; ++k) {
+            if (T.flat) { T.col[k] = c0[k]; T.dx[k] = T.dy[k] = 0.f; continue; }
+            float d1 = c1[k] - c0[k], d2 = c2[k] - c0[k];
+            T.dx[k] = (d1*(p2.y-p0.y) - d2*(p1.y-p0.y)) / area;
+            T.dy[k] = (d2*(p1.x-p0.x) - d1*(p2.x-p0.x)) / area;
+            T.col[k] = c0[k] - T.dx[k]*p0.x - T.dy[k]*p0.y;
+        }
+    }
+
+    void bin(const SoftFramebuffer& fb) {
+        const int tilesX = (fb.w + kTile - 1) / kTile, tilesY = (fb.h + kTile - 1) / kTile;
+        bins_.resize((size_t)tilesX*tilesY);
+        for (auto& b : bins_) b.clear();
+        for (size_t i=0; i<tris_.size(); ++i) {
+            const Tri& T = tris_[i];
+            if (T.empty) continue;
+            for (int ty = T.y0/kTile; ty <= T.y1/kTile; ++ty)
+                for (int tx = T.x0/kTile; tx <= T.x1/kTile; ++tx)
+                    bins_[(size_t)ty*tilesX + tx].push_back((uint32_t)i);
+        }
+    }
+
+    static void drawTri(const Tri& T, SoftFramebuffer& fb, int tx0, int ty0, int tx1, int ty1) {
+        const int ya = std::max(T.y0, ty0), yb = std::min(T.y1, ty1 - 1);
+        for (int py = ya; py <= yb; ++py) {
+            const float yc = py + 0.5f;
+            int lo = std::max(T.x0, tx0), hi = std::min(T.x1, tx1 - 1);
+            bool skip = false;
+            for (int e=0; e<3 && !skip; ++e) {
+                float k = T.b[e]*yc + T.c[e];
+                if (T.a[e] == 0.f) { skip = k < 0.f || (k == 0.f && !T.incl[e]); continue; }
+                float xb = clampf(-k / T.a[e], -1e6f, 1e6f) - 0.5f;   // pixel index whose center is on the edge
+                if (T.a[e] > 0.f) lo = std::max(lo, T.incl[e] ? (int)std::ceil(xb) : (int)std::floor(xb) + 1);
+                else              hi = std::min(hi, T.incl[e] ? (int)std::floor(xb) : (int)std::ceil(xb) - 1);
+            }
+            if (skip || lo > hi) continue;
+            float* d = &fb.px[((size_t)py*fb.w + lo)*4];
+            if (T.flat) blendFlat(d, hi - lo + 1, T.col);
+            else {
+                float c[4];
+                for (int k=0; k<4; ++k) c[k] = T.col[k] + T.dx[k]*(lo + 0.5f) + T.dy[k]*yc;
+                blendRamp(d, hi - lo + 1, c, T.dx);
+            }
+        }
+    }
+
+    // dst = src*src.a + dst*(1 - src.a) on RGBA, one pixel per SIMD register.
+    static void blendFlat(float* d, int n, const float s[4]) {
+#if CLOUD_SIMD_AVX2 || CLOUD_SIMD_SSE2
+        const __m128 a = _mm_set1_ps(s[3]);
+        const __m128 sa = _mm_mul_ps(_mm_loadu_ps(s), a);
+        const __m128 ia = _mm_sub_ps(_mm_set1_ps(1.f), a);
+        for (int i=0; i<n; ++i, d += 4) _mm_storeu_ps(d, _mm_add_ps(sa, _mm_mul_ps(_mm_loadu_ps(d), ia)));
+#else
+        const float a = s[3], ia = 1.f - a;
+        const float sa[4] = { s[0]*a, s[1]*a, s[2]*a, s[3]*a };
+        for (int i=0; i<n; ++i, d += 4)
+            for (int k=0; k<4; ++k) d[k] = sa[k] + d[k]*ia;
+#endif
+    }
+    static void blendRamp(float* d, int n, const float c0[4], const float dc[4]) {
+#if CLOUD_SIMD_AVX2 || CLOUD_SIMD_SSE2
+        __m128 c = _mm_loadu_ps(c0);
+        const __m128 step = _mm_loadu_ps(dc), one = _mm_set1_ps(1.f);
+        for (int i=0; i<n; ++i, d += 4, c = _mm_add_ps(c, step)) {
+            __m128 a = _mm_shuffle_ps(c, c, _MM_SHUFFLE(3,3,3,3));
+            _mm_storeu_ps(d, _mm_add_ps(_mm_mul_ps(c, a), _mm_mul_ps(_mm_loadu_ps(d), _mm_sub_ps(one, a))));
+        }
+#else
+        float c[4] = { c0[0], c0[1], c0[2], c0[3] };
+        for (int i=0; i<n; ++i, d += 4) {
+            const float a = c[3], ia = 1.f - a;
+            for (int k=0; k<4; ++k) { d[k] = c[k]*a + d[k]*ia; c[k] += dc[k]; }
+        }
+#endif
+    }
 
-// Vertex-colored rectangle (for gradients)
-static void fillRectGradient(GLfloat x, GLfloat y, GLfloat w, GLfloat h,
-                             const GLfloat c00[4], const GLfloat c10[4],
-                             const GLfloat c11[4], const GLfloat c01[4]) {
-    const GLfloat verts[] = { x, y,  x+w, y,  x+w, y+h,  x, y+h };
-    const GLfloat cols[]  = {
-        c00[0], c00[1], c00[2], c00[3],
-        c10[0], c10[1], c10[2], c10[3],
-        c11[0], c11[1], c11[2], c11[3],
-        c01[0], c01[1], c01[2], c01[3],
+    std::vector<Tri> tris_;
+    std::vector<size_t> chunkOf_;   // first triangle of each TriBatch chunk, plus end
+    std::vector<std::vector<uint32_t>> bins_;
+};
+
+// ---------- frame capture ----------
+// Records what the window (or the software rasterizer) draws as an image
+// sequence or a video stream. The render thread only reads pixels into one of
+// a few preallocated buffers and queues it. A background thread converts and
+// writes the frames, so file I/O never lands between drawing and
+// SDL_GL_SwapWindow. If every buffer is still queued, the window drops the
+// frame and counts it rather than wait. The headless driver has no deadline,
+// so it waits instead.
+//
+// Formats, picked by extension:
+//   .ppm  binary P6, one file per frame
+//   .png  RGB, one file per frame; deflate "stored" blocks, so lossless with no
+//         compressor to carry, at the cost of size
+//   .y4m  one YUV4MPEG2 stream (4:4:4, BT.601), which ffmpeg and most players
+//         read directly. The size is fixed by the first frame; frames of
+//         another size (after a resize) are dropped.
+// For .ppm and .png, FILE may contain one printf-style %d (e.g. %05d) for the
+// frame number; without it, _%05d is added before the extension.
+enum CaptureFormat { CAPTURE_PPM, CAPTURE_PNG, CAPTURE_Y4M };
+
+struct CaptureFrame {
+    std::vector<uint8_t> px;
+    int w = 0, h = 0;
+    int channels = 3;        // 3 (RGB) or 4 (RGBA; alpha ignored)
+    bool bottomUp = false;   // GL order: row 0 is the bottom of the image
+    uint64_t index = 0;
+};
+
+struct CaptureStats {
+    uint64_t written = 0, dropped = 0, failed = 0, bytes = 0;
+    double encodeSec = 0.0;
+};
+
+static uint32_t crc32(const uint8_t* p, size_t n, uint32_t crc = 0) {
+    struct Table {
+        uint32_t v[256];
+        Table() {
+            for (uint32_t i=0; i<256; ++i) {
+                uint32_t c = i;
+                for (int k=0; k<8; ++k) c = (c & 1) ? 0xedb88320u ^ (c >> 1) : c >> 1;
+                v[i] = c;
+            }
+        }
     };
-    const GLushort idx[] = {0,1,2, 0,2,3};
-    glEnableClientState(GL_VERTEX_ARRAY);
-    glEnableClientState(GL_COLOR_ARRAY);
-    glVertexPointer(2, GL_FLOAT, 0, verts);
-    glColorPointer (4, GL_FLOAT, 0, cols);
-    glDrawElements(GL_TRIANGLES, 6, GL_UNSIGNED_SHORT, idx);
-    glDisableClientState(GL_COLOR_ARRAY);
-    glDisableClientState(GL_VERTEX_ARRAY);
+    static const Table table;                 // built once, on first use
+    crc = ~crc;
+    for (size_t i=0; i<n; ++i) crc = table.v[(crc ^ p[i]) & 0xff] ^ (crc >> 8);
+    return ~crc;
 }
 
-// Solid rectangle
-static void fillRect(GLfloat x, GLfloat y, GLfloat w, GLfloat h, const GLfloat c[4]) {
-    const GLfloat verts[] = { x, y,  x+w, y,  x+w, y+h,  x, y+h };
-    const GLushort idx[] = {0,1,2, 0,2,3};
-    glEnableClientState(GL_VERTEX_ARRAY);
-    glVertexPointer(2, GL_FLOAT, 0, verts);
-    setColor(c[0],c[1],c[2],c[3]);
-    glDrawElements(GL_TRIANGLES, 6, GL_UNSIGNED_SHORT, idx);
-    glDisableClientState(GL_VERTEX_ARRAY);
+static void putBE32(std::vector<uint8_t>& b, uint32_t v) {
+    const uint8_t q[4] = { (uint8_t)(v >> 24), (uint8_t)(v >> 16), (uint8_t)(v >> 8), (uint8_t)v };
+    b.insert(b.end(), q, q + 4);
 }
 
-// Soft “blob” disc: layered rings with fading alpha (cheap radial falloff)
-static void drawSoftBlob(GLfloat cx, GLfloat cy, GLfloat R,
-                         const GLfloat rgb[3], float alphaPeak=0.18f, int rings=8) {
-    // Draw smaller to larger discs, each with lower alpha — gives smooth edges.
-    for (int i=0; i<rings; ++i) {
-        float t = (i+1)/(float)rings;                 // 0..1
-        float r = t*R;
-        float a = alphaPeak * std::pow(1.0f - t, 1.6f);
-        // Triangle fan
-        const int slices = 32;
-        std::vector<GLfloat> v; v.reserve((size_t)2*(slices+2));
-        v.push_back(cx); v.push_back(cy);
-        for (int s=0; s<=slices; ++s) {
-            float ang = (float)s / slices * 2.0f * (float)M_PI;
-            v.push_back(cx + r*std::cos(ang));
-            v.push_back(cy + r*std::sin(ang));
+// Filter byte 0 per row, then a zlib stream of stored deflate blocks.
+template <class RowFn>
+static void encodePNG(int w, int h, RowFn row, std::vector<uint8_t>& raw, std::vector<uint8_t>& out) {
+    const size_t stride = (size_t)w * 3;
+    raw.resize((stride + 1) * h);
+    for (int y=0; y<h; ++y) {
+        raw[y*(stride + 1)] = 0;
+        std::memcpy(&raw[y*(stride + 1) + 1], row(y), stride);
+    }
+    out.clear();
+    static const uint8_t sig[8] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n' };
+    out.insert(out.end(), sig, sig + 8);
+    auto chunk = [&](const char* type, size_t start) {     // data already appended after 8 placeholder bytes
+        const uint32_t len = (uint32_t)(out.size() - start - 8);
+        for (int k=0; k<4; ++k) out[start + k] = (uint8_t)(len >> (24 - 8*k));
+        std::memcpy(&out[start + 4], type, 4);
+        putBE32(out, crc32(&out[start + 4], len + 4));
+    };
+    size_t at = out.size();
+    out.resize(at + 8);
+    putBE32(out, (uint32_t)w); putBE32(out, (uint32_t)h);
+    const uint8_t ihdr[5] = { 8, 2, 0, 0, 0 };            // 8-bit RGB, deflate, no interlace
+    out.insert(out.end(), ihdr, ihdr + 5);
+    chunk("IHDR", at);
+
+    at = out.size();
+    out.resize(at + 8);
+    out.push_back(0x78); out.push_back(0x01);
+    uint32_t a = 1, b = 0;                                 // adler-32
+    for (size_t i=0; i<raw.size(); ) {
+        const size_t n = std::min<size_t>(65535, raw.size() - i);
+        out.push_back(i + n == raw.size() ? 1 : 0);
+        const uint8_t len[4] = { (uint8_t)n, (uint8_t)(n >> 8), (uint8_t)~n, (uint8_t)(~n >> 8) };
+        out.insert(out.end(), len, len + 4);
+        out.insert(out.end(), raw.begin() + i, raw.begin() + i + n);
+        for (size_t j=i; j<i+n; ) {                        // defer the modulo as zlib does
+            const size_t m = std::min<size_t>(5552, i + n - j);
+            for (size_t e=j+m; j<e; ++j) { a += raw[j]; b += a; }
+            a %= 65521; b %= 65521;
         }
-        glEnableClientState(GL_VERTEX_ARRAY);
-        glVertexPointer(2, GL_FLOAT, 0, v.data());
-        glColor4f(rgb[0], rgb[1], rgb[2], a);
-        glDrawArrays(GL_TRIANGLE_FAN, 0, (GLsizei)(v.size()/2));
-        glDisableClientState(GL_VERTEX_ARRAY);
+        i += n;
     }
+    putBE32(out, (b << 16) | a);
+    chunk("IDAT", at);
+
+    at = out.size();
+    out.resize(at + 8);
+    chunk("IEND", at);
 }
 
-// ---------- simple “atmospheric” model ----------
-struct Puff {
-    float x, y;       // position
-    float r;          // radius
-    float vx, vy;     // velocity (advection/updraft)
-    float growth;     // dr/dt
-    float wobble;     // small horizontal meander
-    float life, maxLife; // seconds
-    float whiten;     // 0..1 whiteness (matures as it rises)
+static bool parseCapturePath(const std::string& path, CaptureFormat& fmt, std::string& pattern, std::string& err) {
+    const size_t dot = path.rfind('.');
+    const std::string ext = dot == std::string::npos ? "" : path.substr(dot);
+    if (ext == ".ppm") fmt = CAPTURE_PPM;
+    else if (ext == ".png") fmt = CAPTURE_PNG;
+    else if (ext == ".y4m") fmt = CAPTURE_Y4M;
+    else { err = "expected a .ppm, .png or .y4m file name"; return false; }
+    pattern = path;
+    if (fmt == CAPTURE_Y4M) {
+        if (path.find('%') != std::string::npos) { err = ".y4m is a single stream; drop the %d"; return false; }
+        return true;
+    }
+    const size_t pct = path.find('%');
+    if (pct == std::string::npos) { pattern = path.substr(0, dot) + "_%05d" + ext; return true; }
+    // One %d with an optional zero-padded width; it is handed to snprintf.
+    size_t i = pct + 1;
+    if (i < path.size() && path[i] == '0') ++i;
+    while (i < path.size() && path[i] >= '0' && path[i] <= '9') ++i;
+    if (i >= path.size() || path[i] != 'd' || path.find('%', i) != std::string::npos) {
+        err = "the frame number must be a single %d or %0Nd"; return false;
+    }
+    return true;
+}
+
+class FrameCapture {
+public:
+    // waitForBuffer: block in acquire() instead of dropping when every buffer is queued.
+    FrameCapture(const std::string& pattern, CaptureFormat fmt, int fps, bool waitForBuffer)
+        : pattern_(pattern), fmt_(fmt), fps_(fps), wait_(waitForBuffer) {
+        for (auto& f : frames_) free_.push_back(&f);
+        th_ = std::thread([this]{ run(); });
+    }
+    ~FrameCapture() {
+        { std::lock_guard<std::mutex> lk(m_); quit_ = true; }
+        cv_.notify_all();
+        th_.join();
+        if (y4m_) std::fclose(y4m_);
+    }
+
+    // A buffer sized for w x h, or null (frame dropped) if all are in flight.
+    CaptureFrame* acquire(int w, int h, int channels) {
+        std::unique_lock<std::mutex> lk(m_);
+        if (wait_) cv_.wait(lk, [this]{ return !free_.empty(); });
+        if (free_.empty()) { ++stats_.dropped; return nullptr; }
+        CaptureFrame* f = free_.back();
+        free_.pop_back();
+        lk.unlock();
+        f->w = w; f->h = h; f->channels = channels; f->bottomUp = false;
+        f->px.resize((size_t)w * h * channels);
+        return f;
+    }
+    void submit(CaptureFrame* f) {
+        {
+            std::lock_guard<std::mutex> lk(m_);
+            f->index = next_++;
+            queue_[(head_ + queued_++) % kBuffers] = f;
+        }
+        cv_.notify_all();
+    }
+    // Waits until every submitted frame is written.
+    void flush() {
+        std::unique_lock<std::mutex> lk(m_);
+        cv_.wait(lk, [this]{ return queued_ == 0 && !busy_; });
+    }
+    CaptureStats stats() { std::lock_guard<std::mutex> lk(m_); return stats_; }
+    const std::string& pattern() const { return pattern_; }
+
+private:
+    enum { kBuffers = 4 };
+
+    void run() {
+        std::unique_lock<std::mutex> lk(m_);
+        for (;;) {
+            cv_.wait(lk, [this]{ return queued_ > 0 || quit_; });
+            if (!queued_) return;
+            CaptureFrame* f = queue_[head_];
+            head_ = (head_ + 1) % kBuffers; --queued_;
+            busy_ = true;
+            lk.unlock();
+            auto t0 = std::chrono::steady_clock::now();
+            size_t bytes = 0;
+            const bool ok = encode(*f, bytes);
+            const double sec = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+            lk.lock();
+            if (ok) { ++stats_.written; stats_.bytes += bytes; stats_.encodeSec += sec; }
+            else ++stats_.failed;
+            free_.push_back(f);
+            busy_ = false;
+            cv_.notify_all();
+        }
+    }
+
+    // Image-order RGB row y, converted into rgb_ when the buffer is RGBA.
+    const uint8_t* row(const CaptureFrame& f, int y) {
+        const int src = f.bottomUp ? f.h - 1 - y : y;
+        const uint8_t* p = &f.px[(size_t)src * f.w * f.channels];
+        if (f.channels == 3) return p;
+        rgb_.resize((size_t)f.w * 3);
+        for (int x=0; x<f.w; ++x) { rgb_[3*x] = p[4*x]; rgb_[3*x+1] = p[4*x+1]; rgb_[3*x+2] = p[4*x+2]; }
+        return rgb_.data();
+    }
+
+    bool encode(const CaptureFrame& f, size_t& bytes) {
+        if (fmt_ == CAPTURE_Y4M) return encodeY4M(f, bytes);
+        char name[1024];
+        std::snprintf(name, sizeof name, pattern_.c_str(), (int)f.index);
+        FILE* out = std::fopen(name, "wb");
+        if (!out) { std::fprintf(stderr, "capture: cannot write %s\n", name); return false; }
+        bool ok = true;
+        if (fmt_ == CAPTURE_PPM) {
+            bytes = (size_t)std::fprintf(out, "P6\n%d %d\n255\n", f.w, f.h);
+            for (int y=0; y<f.h && ok; ++y) ok = std::fwrite(row(f, y), 1, (size_t)f.w*3, out) == (size_t)f.w*3;
+            bytes += (size_t)f.w * f.h * 3;
+        } else {
+            encodePNG(f.w, f.h, [&](int y){ return row(f, y); }, raw_, packed_);
+            ok = std::fwrite(packed_.data(), 1, packed_.size(), out) == packed_.size();
+            bytes = packed_.size();
+        }
+        return (std::fclose(out) == 0) && ok;
+    }
+
+    bool encodeY4M(const CaptureFrame& f, size_t& bytes) {
+        if (!y4m_) {
+            y4m_ = std::fopen(pattern_.c_str(), "wb");
+            if (!y4m_) { std::fprintf(stderr, "capture: cannot write %s\n", pattern_.c_str()); return false; }
+            yw_ = f.w; yh_ = f.h;
+            bytes += (size_t)std::fprintf(y4m_, "YUV4MPEG2 W%d H%d F%d:1 Ip A1:1 C444\n", yw_, yh_, fps_);
+        }
+        if (f.w != yw_ || f.h != yh_) {
+            if (!warnedSize_) std::fprintf(stderr, "capture: frame size changed from %dx%d; dropping until it is back\n", yw_, yh_);
+            warnedSize_ = true;
+            return false;
+        }
+        const size_t n = (size_t)f.w * f.h;
+        planes_.resize(3*n);
+        uint8_t *Y = planes_.data(), *U = Y + n, *V = U + n;
+        for (int y=0; y<f.h; ++y) {
+            const uint8_t* p = row(f, y);
+            for (int x=0; x<f.w; ++x, p += 3) {
+                const int r = p[0], g = p[1], b = p[2];
+                const size_t i = (size_t)y*f.w + x;
+                Y[i] = (uint8_t)(((66*r + 129*g + 25*b + 128) >> 8) + 16);
+                U[i] = (uint8_t)(((-38*r - 74*g + 112*b + 128) >> 8) + 128);
+                V[i] = (uint8_t)(((112*r - 94*g - 18*b + 128) >> 8) + 128);
+            }
+        }
+        const bool ok = std::fputs("FRAME\n", y4m_) >= 0 && std::fwrite(planes_.data(), 1, planes_.size(), y4m_) == planes_.size();
+        bytes += 6 + planes_.size();
+        return ok;
+    }
+
+    std::string pattern_;
+    CaptureFormat fmt_;
+    int fps_;
+    bool wait_;
+    CaptureFrame frames_[kBuffers];
+    std::vector<CaptureFrame*> free_;        // never more than kBuffers, so push_back stops allocating after the constructor
+    CaptureFrame* queue_[kBuffers] = {};     // ring, oldest at head_
+    int head_ = 0, queued_ = 0;
+    bool busy_ = false, quit_ = false;
+    uint64_t next_ = 0;
+    CaptureStats stats_;
+    std::mutex m_;
+    std::condition_variable cv_;
+    // Encoder-thread state.
+    std::vector<uint8_t> rgb_, raw_, packed_, planes_;
+    FILE* y4m_ = nullptr;
+    int yw_ = 0, yh_ = 0;
+    bool warnedSize_ = false;
+    std::thread th_;                         // last: starts once everything above exists
 };
 
-struct Emitter {
-    float x0, x1;     // horizontal source span (near ground)
-    float y;          // emission height
-    float rate;       // puffs/sec
+static void printCaptureStats(FrameCapture& cap) {
+    const CaptureStats cs = cap.stats();
+    std::printf("capture: %llu frames to %s (%.1f MB, %.2f ms/frame encoding), %llu dropped, %llu failed\n",
+                (unsigned long long)cs.written, cap.pattern().c_str(), cs.bytes / 1048576.0,
+                cs.written ? 1e3 * cs.encodeSec / cs.written : 0.0,
+                (unsigned long long)cs.dropped, (unsigned long long)cs.failed);
+}
+
+// ---------- microbenchmarks ----------
+// Google-Benchmark-style runner for the hot kernels: each case repeats its body
+// until it has run for at least kMinTime, then reports time/iteration and items/s.
+// Cases that call GL are only registered in -DCLOUD_STUB_GL builds.
+class BenchState {
+public:
+    explicit BenchState(int64_t iters) : left_(iters), iters_(iters) {}
+    bool keepRunning() {
+        if (!started_) { started_ = true; start(); }   // setup before the loop is not timed
+        if (left_-- > 0) return true;
+        if (running_) stop();
+        return false;
+    }
+    void start()  { t0_ = std::chrono::steady_clock::now(); running_ = true; }
+    void stop()   { elapsed_ += std::chrono::steady_clock::now() - t0_; running_ = false; }
+    void pauseTiming()  { stop(); }
+    void resumeTiming() { start(); }
+    void setItemsProcessed(int64_t n) { items_ = n; }
+    int64_t iterations() const { return iters_; }
+    int64_t items() const { return items_; }
+    double seconds() const { return std::chrono::duration<double>(elapsed_).count(); }
+
+private:
+    int64_t left_, iters_, items_ = 0;
+    bool running_ = false, started_ = false;
+    std::chrono::steady_clock::time_point t0_;
+    std::chrono::steady_clock::duration elapsed_{};
 };
 
-static void spawnPuff(std::vector<Puff>& P, const Emitter& E, int winW, int winH) {
-    Puff p{};
-    p.x = E.x0 + frand()*(E.x1 - E.x0);
-    p.y = E.y + frand()*10.f;
-    p.r = 12.f + frand()*10.f;
-    p.vx = (frand()-0.5f)*8.f;     // gentle breeze
-    p.vy = 12.f + frand()*10.f;    // updraft
-    p.growth = 3.f + frand()*6.f;  // grows as condenses
-    p.wobble = (frand()*2.f - 1.f) * 0.8f;
-    p.life = 0.f;
-    p.maxLife = 18.f + frand()*8.f;
-    p.whiten = 0.2f;
-    P.push_back(p);
-}
-
-static void updatePuffs(std::vector<Puff>& P, float dt, float breeze, int winW, int winH) {
-    for (auto& p : P) {
-        p.life += dt;
-        // Updraft weakens with height; breeze blows right
-        float heightNorm = clampf(p.y / (float)winH, 0.f, 1.f);
-        float up = (1.0f - 0.4f*heightNorm);
-        p.vy = 10.f * up + 8.f;                // keep rising gently
-        p.vx += (breeze - p.vx) * 0.05f;       // ease toward breeze
-        p.x  += (p.vx + p.wobble*std::sin(2.0f*p.life)) * dt;
-        p.y  += p.vy * dt;
-        p.r  += p.growth * dt * (0.6f + 0.4f*(1.0f-heightNorm));
-        p.whiten = clampf(p.whiten + dt*0.15f, 0.f, 1.f);
-        // confine horizontally (wrap)
-        if (p.x < -100.f) p.x += (float)winW + 200.f;
-        if (p.x >  winW+100.f) p.x -= (float)winW + 200.f;
+struct BenchCase {
+    std::string name;
+    std::function<void(BenchState&)> fn;
+};
+
+static const double kMinBenchTime = 0.25;   // seconds per case
+
+// Make v look used so the optimizer can't drop the computation behind it.
+template <class T> static inline void doNotOptimize(const T& v) { asm volatile("" : : "r,m"(v) : "memory"); }
+
+// Scatter N puffs over the domain at mixed ages, as a steady-state population looks.
+static void fillBenchPopulation(PuffField& P, size_t n, int winW, int winH, uint64_t seed) {
+    P.clear();
+    if (P.budget < n) P.setBudget(n, OVERFLOW_DROP_NEWEST);
+    Rng rng(seed);
+    Emitter domain{ 0.f, (float)winW, 0.f, 0.f };
+    spawnPuffs(P, domain, (int)n, rng);
+    for (size_t i=0; i<P.size(); ++i) {
+        P.y[i] = rng.uniform() * winH;
+        P.life[i] = rng.uniform() * 16.f;
+        P.whiten[i] = rng.uniform();
     }
-    // remove old/high puffs
-    P.erase(std::remove_if(P.begin(), P.end(), [&](const Puff& p){
-        return (p.life > p.maxLife) || (p.y - p.r > winH*1.1f);
-    }), P.end());
 }
 
-// Soft compositing: draw many overlapping blobs to suggest merging/formation
-static void drawClouds(const std::vector<Puff>& P) {
-    for (const auto& p : P) {
-        // base tint slightly bluish-grey near source, turns white as it matures
-        float w = p.whiten;
-        GLfloat rgb[3] = {
-            0.85f*w + 0.75f*(1.f-w),
-            0.86f*w + 0.78f*(1.f-w),
-            0.90f*w + 0.82f*(1.f-w)
-        };
-        // use higher alpha in the center for smaller puffs; larger ones get softer
-        float peak = 0.22f * (1.0f / (1.0f + 0.004f*p.r));
-        drawSoftBlob(p.x, p.y, p.r, rgb, peak, 9);
+static std::vector<BenchCase> kernelBenchmarks(int winW, int winH) {
+    std::vector<BenchCase> B;
+    const float dt = 1.f/60.f;
+
+    for (int n : { 64, 4096 }) {
+        B.push_back({ "spawnPuffs/" + std::to_string(n), [=](BenchState& st) {
+            PuffField P; P.setBudget((size_t)n, OVERFLOW_DROP_NEWEST);
+            Rng rng(1);
+            Emitter E{ winW*0.18f, winW*0.38f, 110.f, 4.f };
+            while (st.keepRunning()) { P.resize(0); spawnPuffs(P, E, n, rng); }
+            st.setItemsProcessed(st.iterations() * n);
+        }});
+    }
+
+    // Population size × share of puffs dying this step × retirement mode.
+    for (int n : { 1000, 65536, 1000000 })
+        for (int pct : { 0, 1, 10 })
+            for (RetireMode mode : { RETIRE_STABLE, RETIRE_SWAP }) {
+                std::string name = "updatePuffs/" + std::to_string(n) + "/retire:" + std::to_string(pct) + "%/" +
+                                   (mode == RETIRE_SWAP ? "swap" : "stable");
+                B.push_back({ name, [=](BenchState& st) {
+                    PuffField pristine, P;
+                    fillBenchPopulation(pristine, (size_t)n, winW, winH, 2);
+                    Rng rng(3);
+                    for (size_t i=0; i<pristine.size(); ++i)
+                        if (rng.uniform()*100.f < pct) pristine.life[i] = pristine.maxLife[i];
+                    P.setBudget((size_t)n, OVERFLOW_DROP_NEWEST);
+                    UpdateScratch scratch;
+                    const StepParams sp{ dt, 12.f, (float)winW, (float)winH, WindView() };
+                    while (st.keepRunning()) {
+                        st.pauseTiming();
+                        P.forEachColumn([&](auto& c){ c.clear(); });
+                        P.x = pristine.x; P.y = pristine.y; P.r = pristine.r; P.vx = pristine.vx;
+                        P.vy = pristine.vy; P.growth = pristine.growth; P.wobble = pristine.wobble;
+                        P.life = pristine.life; P.maxLife = pristine.maxLife; P.whiten = pristine.whiten;
+                        P.id = pristine.id;
+                        st.resumeTiming();
+                        updatePuffs(P, sp, mode, scratch);
+                    }
+                    st.setItemsProcessed(st.iterations() * n);
+                }});
+            }
+
+    // Spatial grid, timed apart from the physics: counting-sort build, column
+    // reorder, and a neighbour sweep over the reordered field.
+    for (int n : { 65536, 1000000 }) {
+        B.push_back({ "gridBuild/" + std::to_string(n), [=](BenchState& st) {
+            PuffField P;
+            fillBenchPopulation(P, (size_t)n, winW, winH, 6);
+            PuffGrid G;
+            while (st.keepRunning()) G.build(P, 64.f, winW, winH);
+            st.setItemsProcessed(st.iterations() * n);
+        }});
+        // shuffled: first sort of a random field. steady: already in cell order, as
+        // it is from the second step on, so the gather is nearly sequential.
+        for (bool steady : { false, true })
+            B.push_back({ "gridReorder/" + std::to_string(n) + (steady ? "/steady" : "/shuffled"), [=](BenchState& st) {
+                PuffField P;
+                fillBenchPopulation(P, (size_t)n, winW, winH, 6);
+                PuffGrid G;
+                G.build(P, 64.f, winW, winH);
+                if (steady) { G.reorder(P); G.build(P, 64.f, winW, winH); }
+                while (st.keepRunning()) G.reorder(P);   // the same permutation applied again
+                st.setItemsProcessed(st.iterations() * n);
+            }});
+    }
+    B.push_back({ "gridQuery/65536", [=](BenchState& st) {
+        PuffField P;
+        fillBenchPopulation(P, 65536, winW * 8, winH * 8, 6);   // ~1 puff per 64 px²
+        PuffGrid G;
+        G.build(P, 64.f, winW * 8, winH * 8);
+        G.reorder(P);
+        while (st.keepRunning()) {
+            size_t hits = 0;
+            for (size_t i=0; i<P.size(); ++i)
+                G.forNear(P.x[i], P.y[i], 32.f, [&](uint32_t j) {
+                    float dx = P.x[j] - P.x[i], dy = P.y[j] - P.y[i];
+                    hits += dx*dx + dy*dy < 32.f*32.f;
+                });
+            doNotOptimize(hits);
+        }
+        st.setItemsProcessed(st.iterations() * 65536);
+    }});
+
+    B.push_back({ "coalescePuffs/65536", [=](BenchState& st) {
+        PuffField pristine, P;
+        fillBenchPopulation(pristine, 65536, winW * 8, winH * 8, 7);
+        PuffGrid G;
+        G.build(pristine, 64.f, winW * 8, winH * 8);
+        G.reorder(pristine);
+        MergeParams mp;
+        MergeScratch scratch;
+        MergeStats stats;
+        Rng rng(8);
+        while (st.keepRunning()) {
+            st.pauseTiming();
+            P = pristine;
+            st.resumeTiming();
+            coalescePuffs(P, G, mp, RETIRE_STABLE, scratch, rng, stats);
+        }
+        st.setItemsProcessed(st.iterations() * 65536);
+    }});
+
+    for (int n : { 256, 1024 }) {
+        B.push_back({ "atmosStep/" + std::to_string(n) + "x" + std::to_string(n), [=](BenchState& st) {
+            std::vector<Emitter> E = {
+                { winW*0.18f, winW*0.38f, 110.f, 4.0f },
+                { winW*0.62f, winW*0.82f, 120.f, 3.2f }
+            };
+            WindField W;
+            W.init(n, n, winW, winH);
+            W.setThermals(E);
+            W.step(1.f/60.f, 18.f, nullptr);
+            AtmosGrid A;
+            A.init(n, n, winW, winH);
+            for (int i=0; i<60; ++i) A.step(1.f/60.f, E, W, nullptr);   // past the first-second transient
+            while (st.keepRunning()) A.step(1.f/60.f, E, W, nullptr);
+            st.setItemsProcessed(st.iterations() * n * n);
+        }});
+    }
+
+    // Cold pressure solves (no warm start) on thermal-shaped divergence.
+    for (int n : { 128, 1024 }) {
+        B.push_back({ "multigridSolve/" + std::to_string(n) + "x" + std::to_string(n), [=](BenchState& st) {
+            WindField W;
+            W.init(n, n, winW, winH);
+            W.projectOn = true;
+            W.setThermals({ { winW*0.18f, winW*0.38f, 110.f, 4.f }, { winW*0.62f, winW*0.82f, 120.f, 3.2f } });
+            W.step(1.f/60.f, 12.f, nullptr);
+            const AlignedVec<float> u0 = W.u, v0 = W.v;
+            while (st.keepRunning()) {
+                st.pauseTiming();
+                W.u = u0; W.v = v0;
+                W.poisson.reset();
+                st.resumeTiming();
+                W.project(nullptr);
+            }
+            st.setItemsProcessed(st.iterations() * n * n);
+        }});
+    }
+
+    // Particle-in-cell coupling on the default 128x80 wind grid: the update
+    // kernel with its bilinear wind gathers, and the banded buoyancy scatter.
+    B.push_back({ "updatePuffs/65536/wind", [=](BenchState& st) {
+        PuffField pristine, P;
+        fillBenchPopulation(pristine, 65536, winW, winH, 2);
+        for (size_t i=0; i<pristine.size(); ++i) pristine.maxLife[i] = 1e9f;   // nobody retires
+        WindField W;
+        W.init(128, 80, winW, winH);
+        W.setThermals({ { winW*0.18f, winW*0.38f, 110.f, 4.f } });
+        W.step(1.f/60.f, 12.f, nullptr);
+        StepParams sp{ 1.f/60.f, 12.f, (float)winW, (float)winH, W.view() };
+        UpdateScratch scratch;
+        while (st.keepRunning()) {
+            st.pauseTiming();
+            P = pristine;
+            st.resumeTiming();
+            updatePuffs(P, sp, RETIRE_STABLE, scratch);
+        }
+        st.setItemsProcessed(st.iterations() * 65536);
+    }});
+    B.push_back({ "windDeposit/65536", [=](BenchState& st) {
+        PuffField P;
+        fillBenchPopulation(P, 65536, winW, winH, 9);
+        WindField W;
+        W.init(128, 80, winW, winH);
+        while (st.keepRunning()) { W.deposit(P, nullptr); doNotOptimize(W.cover[0]); }
+        st.setItemsProcessed(st.iterations() * 65536);
+    }});
+
+    B.push_back({ "buildRingFan/9rings", [](BenchState& st) {
+        const UnitCircle& uc = unitCircle(kBlobSlices);
+        const RingProfile& rp = ringProfile(kPuffRings);
+        std::vector<GLfloat> v((size_t)2*(uc.slices+2));
+        while (st.keepRunning()) {
+            for (int i=0; i<rp.rings; ++i) { buildRingFan(v.data(), uc, 320.f, 240.f, rp.t[i]*40.f); doNotOptimize(v[3]); }
+        }
+        st.setItemsProcessed(st.iterations() * kPuffRings);
+    }});
+
+    for (int n : { 1000, 10000 }) {
+        B.push_back({ "appendClouds/" + std::to_string(n), [=](BenchState& st) {
+            PuffField P;
+            fillBenchPopulation(P, (size_t)n, winW, winH, 4);
+            TriBatch batch;
+            while (st.keepRunning()) { batch.clear(); appendClouds(batch, P.view()); }
+            st.setItemsProcessed(st.iterations() * n);
+        }});
+        B.push_back({ "appendSplatClouds/" + std::to_string(n), [=](BenchState& st) {
+            PuffField P;
+            fillBenchPopulation(P, (size_t)n, winW, winH, 4);
+            SplatBatch batch;
+            while (st.keepRunning()) { batch.clear(); appendSplatClouds(batch, P.view()); }
+            st.setItemsProcessed(st.iterations() * n);
+        }});
+        B.push_back({ "appendSpriteClouds/" + std::to_string(n), [=](BenchState& st) {
+            PuffField P;
+            fillBenchPopulation(P, (size_t)n, winW, winH, 4);
+            std::vector<SpriteVertex> sprites;
+            SplatBatch quads;
+            while (st.keepRunning()) {
+                sprites.clear(); quads.clear();
+                appendSpriteClouds(sprites, quads, P.view(), winW, winH, 64.f);
+            }
+            st.setItemsProcessed(st.iterations() * n);
+        }});
+    }
+
+#ifdef CLOUD_STUB_GL
+    for (bool cached : { false, true }) {
+        B.push_back({ std::string("drawSoftBlob/9rings/") + (cached ? "fan-cache" : "trig"), [=](BenchState& st) {
+            const bool saved = g_useFanCache;
+            g_useFanCache = cached;
+            const GLfloat rgb[3] = { 0.8f, 0.82f, 0.86f };
+            while (st.keepRunning()) drawSoftBlob(320.f, 240.f, 40.f, rgb, 0.2f, kPuffRings);
+            g_useFanCache = saved;
+            st.setItemsProcessed(st.iterations() * kPuffRings);
+        }});
+    }
+    B.push_back({ "drawClouds/1000", [=](BenchState& st) {
+        PuffField P;
+        fillBenchPopulation(P, 1000, winW, winH, 5);
+        while (st.keepRunning()) drawClouds(P.view());
+        st.setItemsProcessed(st.iterations() * 1000);
+    }});
+    B.push_back({ "fillRectGradient", [](BenchState& st) {
+        while (st.keepRunning()) fillRectGradient(0.f, 270.f, 960.f, 330.f, kSkyTop, kSkyTop, kSkyMid, kSkyMid);
+        st.setItemsProcessed(st.iterations());
+    }});
+#endif
+    return B;
+}
+
+static void printBenchTime(char* out, size_t n, double sec) {
+    if (sec < 1e-6)      std::snprintf(out, n, "%.1f ns", sec*1e9);
+    else if (sec < 1e-3) std::snprintf(out, n, "%.2f us", sec*1e6);
+    else                 std::snprintf(out, n, "%.3f ms", sec*1e3);
+}
+
+// ---------- command line ----------
+// A swept parameter: lo..hi, or a single value when lo == hi.
+struct SweepRange { float lo, hi; };
+
+struct Options {
+    int benchFrames = 0;      // --bench[=N]: time N frames on each blob path, then exit
+    int winW = 960, winH = 600;                // --size=WxH
+    bool headless = false;                     // --headless: no SDL window or GL context
+    long steps = 10000;                        // --steps=N (headless)
+    float dt = 1.f/60.f;                       // --dt=S    (headless fixed step)
+    float rateScale = 1.f;                     // --rate-scale=K: multiply emitter rates
+    int threads = 0;                           // --threads=N; 0 → all hardware threads
+    float simHz = 0.f;                         // --sim-thread[=HZ]: fixed-tick sim on its own thread
+    bool profile = false;                      // --profile: per-phase frame timings
+    std::string profileOut;                    // --profile-out=FILE.csv|FILE.json (implies --profile)
+    std::vector<long> benchThreadSizes;        // --bench-threads[=N,N,...]: update scaling table
+    bool benchKernels = false;                 // --bench-kernels[=FILTER]: microbenchmark suite
+    std::string benchFilter;
+    std::string benchOut;                      // --bench-out=FILE.csv
+    RenderBackend render = RENDER_IMMEDIATE;   // --render=immediate|batched|splat|sprite
+    RetireMode retire = RETIRE_STABLE;         // --retire=stable|swap
+    size_t maxPuffs = 20000;                   // --max-puffs=N: pool budget
+    OverflowPolicy overflow = OVERFLOW_DROP_OLDEST;   // --overflow=oldest|newest|grow
+    float gridCell = 0.f;                      // --grid[=CELL]: spatial grid + cell-order reordering each step
+    int windX = 0, windY = 0;                  // --wind[=NXxNY]: gridded wind carries the puffs (default 128x80)
+    float buoyancy = 0.f;                      // --buoyancy[=G]: puff cover drives updrafts, px/s² (default 3; implies --wind)
+    float projectTol = 0.f;                    // --project[=TOL]: multigrid pressure projection of the wind (default 1e-3; implies --wind)
+    std::string projectLog;                    // --project-log=FILE.csv: per-step solver report (headless)
+    int atmosX = 0, atmosY = 0;                // --atmos[=NXxNY]: moisture/temperature grid (default 256x160)
+    bool merge = false;                        // --merge: coalesce overlapping mature puffs (uses the grid)
+    float splitRadius = 0.f;                   // --split[=R]: split puffs larger than R px (default 110)
+    bool bgCache = false;                      // --bg-cache: sky/ground/hills cached in a texture (window) or framebuffer (soft)
+    bool vbo = false;                          // --vbo: stream geometry through VBOs, static background
+    int softEvery = 0;                         // --soft-render[=K]: headless, rasterize every K-th step on the CPU
+    std::string softOut;                       // --soft-out=FILE.ppm: last software frame (implies --soft-render)
+    std::string snapshot;                      // --snapshot=FILE: save the state on exit (and every N steps)
+    long snapshotEvery = 0;                    // --snapshot-every=N: background snapshot every N steps
+    std::string restore;                       // --restore=FILE: resume from a snapshot
+    std::string trajectory;                    // --trajectory=FILE: memory-mapped per-step puff tracks (+ FILE.idx)
+    long trajectoryEvery = 1;                  // --trajectory-every=N: record every N-th step
+    std::string readTrajectory;                // --read-trajectory=FILE[@K]: summarize a trajectory file, then exit
+    std::string capture;                       // --capture=FILE.ppm|FILE.png|FILE.y4m: record every drawn frame
+    CaptureFormat captureFormat = CAPTURE_PPM; //   (capture holds the per-frame file name pattern)
+    int ensemble = 0;                          // --ensemble[=N]: N independent headless members (default 64)
+    SweepRange sweepRate{1.f, 1.f};            // --sweep-rate=A[:B]: emitter rate multiplier
+    SweepRange sweepBreeze{12.f, 12.f};        // --sweep-breeze=A[:B]: breeze, px/s
+    SweepRange sweepGrowth{1.f, 1.f};          // --sweep-growth=A[:B]: puff growth multiplier
+    SweepRange sweepLife{1.f, 1.f};            // --sweep-life=A[:B]: puff lifetime multiplier
+    std::string ensembleOut;                   // --ensemble-out=FILE.csv: one row per member
+    bool hasSeed = false;                      // --seed=N; otherwise time-based and printed
+    uint64_t seed = 0;
+};
+
+static bool parseRender(const char* name, RenderBackend& out) {
+    for (int i=0; i<RENDER_COUNT; ++i)
+        if (!std::strcmp(name, kRenderNames[i])) { out = (RenderBackend)i; return true; }
+    return false;
+}
+
+static bool parseSweep(const char* text, SweepRange& out) {
+    float lo, hi;
+    const int n = std::sscanf(text, "%f:%f", &lo, &hi);
+    if (n < 1) return false;
+    out.lo = lo; out.hi = n == 2 ? hi : lo;
+    return true;
+}
+
+static Options parseArgs(int argc, char** argv) {
+    Options o;
+    for (int i=1; i<argc; ++i) {
+        const char* a = argv[i];
+        if (!std::strcmp(a, "--bench")) o.benchFrames = 600;
+        else if (!std::strncmp(a, "--bench=", 8)) o.benchFrames = std::max(1, std::atoi(a+8));
+        else if (!std::strncmp(a, "--size=", 7)) {
+            if (std::sscanf(a+7, "%dx%d", &o.winW, &o.winH) != 2 || o.winW <= 0 || o.winH <= 0) {
+                std::fprintf(stderr, "bad --size, expected WxH: %s\n", a+7);
+                o.winW = 960; o.winH = 600;
+            }
+        }
+        else if (!std::strcmp(a, "--headless")) o.headless = true;
+        else if (!std::strncmp(a, "--steps=", 8)) o.steps = std::max(1L, std::atol(a+8));
+        else if (!std::strncmp(a, "--dt=", 5)) o.dt = std::max(1e-4f, (float)std::atof(a+5));
+        else if (!std::strncmp(a, "--rate-scale=", 13)) o.rateScale = std::max(0.f, (float)std::atof(a+13));
+        else if (!std::strcmp(a, "--sim-thread")) o.simHz = 60.f;
+        else if (!std::strncmp(a, "--sim-thread=", 13)) o.simHz = std::max(1.f, (float)std::atof(a+13));
+        else if (!std::strcmp(a, "--profile")) o.profile = true;
+        else if (!std::strncmp(a, "--profile-out=", 14)) { o.profile = true; o.profileOut = a+14; }
+        else if (!std::strncmp(a, "--threads=", 10)) o.threads = std::max(0, std::atoi(a+10));
+        else if (!std::strcmp(a, "--bench-kernels")) o.benchKernels = true;
+        else if (!std::strncmp(a, "--bench-kernels=", 16)) { o.benchKernels = true; o.benchFilter = a+16; }
+        else if (!std::strncmp(a, "--bench-out=", 12)) o.benchOut = a+12;
+        else if (!std::strcmp(a, "--bench-threads")) o.benchThreadSizes = { 100000, 1000000, 10000000 };
+        else if (!std::strncmp(a, "--bench-threads=", 16)) {
+            o.benchThreadSizes.clear();
+            for (const char* q = a+16; *q; ) {
+                char* endp;
+                long v = std::strtol(q, &endp, 10);
+                if (endp == q) break;
+                if (v > 0) o.benchThreadSizes.push_back(v);
+                q = (*endp == ',') ? endp + 1 : endp;
+            }
+        }
+        else if (!std::strncmp(a, "--render=", 9)) {
+            if (!parseRender(a+9, o.render)) std::fprintf(stderr, "unknown render backend: %s\n", a+9);
+        }
+        else if (!std::strcmp(a, "--retire=stable")) o.retire = RETIRE_STABLE;
+        else if (!std::strcmp(a, "--retire=swap"))   o.retire = RETIRE_SWAP;
+        else if (!std::strncmp(a, "--max-puffs=", 12)) o.maxPuffs = (size_t)std::max(1L, std::atol(a+12));
+        else if (!std::strcmp(a, "--overflow=oldest")) o.overflow = OVERFLOW_DROP_OLDEST;
+        else if (!std::strcmp(a, "--overflow=newest")) o.overflow = OVERFLOW_DROP_NEWEST;
+        else if (!std::strcmp(a, "--overflow=grow"))   o.overflow = OVERFLOW_GROW;
+        else if (!std::strcmp(a, "--grid")) o.gridCell = 64.f;
+        else if (!std::strncmp(a, "--grid=", 7)) o.gridCell = std::max(4.f, (float)std::atof(a+7));
+        else if (!std::strcmp(a, "--wind")) { o.windX = 128; o.windY = 80; }
+        else if (!std::strncmp(a, "--wind=", 7)) {
+            if (std::sscanf(a+7, "%dx%d", &o.windX, &o.windY) != 2 || o.windX < 2 || o.windY < 2) {
+                std::fprintf(stderr, "bad --wind, expected NXxNY: %s\n", a+7);
+                o.windX = 128; o.windY = 80;
+            }
+        }
+        else if (!std::strcmp(a, "--buoyancy")) o.buoyancy = 3.f;
+        else if (!std::strncmp(a, "--buoyancy=", 11)) o.buoyancy = std::max(0.f, (float)std::atof(a+11));
+        else if (!std::strcmp(a, "--project")) o.projectTol = 1e-3f;
+        else if (!std::strncmp(a, "--project=", 10)) o.projectTol = std::max(1e-7f, (float)std::atof(a+10));
+        else if (!std::strncmp(a, "--project-log=", 14)) { o.projectLog = a+14; if (o.projectTol <= 0.f) o.projectTol = 1e-3f; }
+        else if (!std::strcmp(a, "--atmos")) { o.atmosX = 256; o.atmosY = 160; }
+        else if (!std::strncmp(a, "--atmos=", 8)) {
+            if (std::sscanf(a+8, "%dx%d", &o.atmosX, &o.atmosY) != 2 || o.atmosX < 2 || o.atmosY < 2) {
+                std::fprintf(stderr, "bad --atmos, expected NXxNY: %s\n", a+8);
+                o.atmosX = 256; o.atmosY = 160;
+            }
+        }
+        else if (!std::strcmp(a, "--merge")) o.merge = true;
+        else if (!std::strcmp(a, "--split")) o.splitRadius = 110.f;
+        else if (!std::strncmp(a, "--split=", 8)) o.splitRadius = std::max(1.f, (float)std::atof(a+8));
+        else if (!std::strcmp(a, "--vbo")) o.vbo = true;
+        else if (!std::strcmp(a, "--bg-cache")) o.bgCache = true;
+        else if (!std::strcmp(a, "--soft-render")) o.softEvery = 1;
+        else if (!std::strncmp(a, "--soft-render=", 14)) o.softEvery = std::max(1, std::atoi(a+14));
+        else if (!std::strncmp(a, "--soft-out=", 11)) { o.softOut = a+11; o.softEvery = std::max(1, o.softEvery); }
+        else if (!std::strncmp(a, "--snapshot=", 11)) o.snapshot = a+11;
+        else if (!std::strncmp(a, "--snapshot-every=", 17)) {
+            o.snapshotEvery = std::max(1L, std::atol(a+17));
+            if (o.snapshot.empty()) o.snapshot = "cloud.snap";
+        }
+        else if (!std::strncmp(a, "--restore=", 10)) o.restore = a+10;
+        else if (!std::strncmp(a, "--trajectory=", 13)) o.trajectory = a+13;
+        else if (!std::strncmp(a, "--trajectory-every=", 19)) o.trajectoryEvery = std::max(1L, std::atol(a+19));
+        else if (!std::strncmp(a, "--read-trajectory=", 18)) o.readTrajectory = a+18;
+        else if (!std::strncmp(a, "--capture=", 10)) {
+            std::string err;
+            if (!parseCapturePath(a+10, o.captureFormat, o.capture, err)) {
+                std::fprintf(stderr, "bad --capture (%s): %s\n", err.c_str(), a+10);
+                o.capture.clear();
+            }
+            o.softEvery = std::max(1, o.softEvery);   // headless: capture the software frames
+        }
+        else if (!std::strcmp(a, "--ensemble")) o.ensemble = 64;
+        else if (!std::strncmp(a, "--ensemble=", 11)) o.ensemble = std::max(1, std::atoi(a+11));
+        else if (!std::strncmp(a, "--ensemble-out=", 15)) o.ensembleOut = a+15;
+        else if (!std::strncmp(a, "--sweep-", 8)) {
+            const char* eq = std::strchr(a, '=');
+            const std::string name = eq ? std::string(a+8, eq) : std::string(a+8);
+            SweepRange* r = name == "rate" ? &o.sweepRate : name == "breeze" ? &o.sweepBreeze :
+                            name == "growth" ? &o.sweepGrowth : name == "life" ? &o.sweepLife : nullptr;
+            if (!r || !eq || !parseSweep(eq+1, *r)) std::fprintf(stderr, "bad sweep, expected --sweep-rate|breeze|growth|life=A[:B]: %s\n", a);
+        }
+        else if (!std::strncmp(a, "--seed=", 7)) { o.hasSeed = true; o.seed = std::strtoull(a+7, nullptr, 10); }
+        else std::fprintf(stderr, "ignoring unknown option: %s\n", a);
+    }
+    // The projection runs on the wind grid, which --atmos replaces.
+    const bool atmos = o.atmosX > 0;
+    int& cx = atmos ? o.atmosX : o.windX;
+    int& cy = atmos ? o.atmosY : o.windY;
+    const int nx = cx, ny = cy;
+    if (o.projectTol > 0.f && nx > 0 && multigridRound(cx, cy))
+        std::fprintf(stderr, "project: rounding the %dx%d grid up to %dx%d so the multigrid can coarsen\n", nx, ny, cx, cy);
+    return o;
+}
+
+static int threadCount(const Options& opt) {
+    return opt.threads > 0 ? opt.threads : (int)std::max(1u, std::thread::hardware_concurrency());
+}
+
+static void configureSimulation(Simulation& sim, const Options& opt) {
+    sim.retire = opt.retire;
+    sim.gridCell = opt.gridCell;
+    sim.coalesce = opt.merge || opt.splitRadius > 0.f;
+    sim.mergeParams.merge = opt.merge;
+    sim.mergeParams.splitRadius = opt.splitRadius;
+    sim.puffs.setBudget(opt.maxPuffs, opt.overflow);
+    for (auto& e: sim.emitters) e.rate *= opt.rateScale;
+    if (opt.windX > 0) sim.enableWind(opt.windX, opt.windY);
+    else if (opt.buoyancy > 0.f) sim.enableWind(128, 80);
+    if (opt.atmosX > 0) sim.enableAtmosphere(opt.atmosX, opt.atmosY);
+    if (opt.projectTol > 0.f) sim.enableProjection(opt.projectTol);
+    sim.wind.params.buoyancy = opt.buoyancy;
+}
+
+// ---------- headless driver ----------
+// Steps a fixed dt as fast as the CPU allows; no SDL, no GL, no vsync.
+static int runHeadless(const Options& opt, uint64_t seed) {
+    TaskPool pool(threadCount(opt));
+    Simulation sim(opt.winW, opt.winH, seed);
+    configureSimulation(sim, opt);
+    sim.pool = &pool;
+    if (!opt.restore.empty() && !restoreFromFile(sim, opt.restore, opt.winW, opt.winH)) return 1;
+    std::unique_ptr<SnapshotWriter> snaps;
+    if (!opt.snapshot.empty()) snaps.reset(new SnapshotWriter(opt.snapshot));
+    TrajectoryWriter tracks;
+    const bool tracking = !opt.trajectory.empty() && tracks.open(opt.trajectory, sim.winW, sim.winH);
+    TriBatch batch;
+    SoftFramebuffer fb, background;
+    SoftRenderer soft;
+    const float black[4] = {0.f, 0.f, 0.f, 1.f};
+    fb.resize(opt.winW, opt.winH);
+    if (opt.softEvery > 0 && opt.bgCache) {
+        // The headless domain never resizes, so the background is rendered once.
+        background.resize(opt.winW, opt.winH);
+        appendBackground(batch, opt.winW, opt.winH);
+        soft.render(batch, background, black, &pool);
+    }
+    long softFrames = 0;
+    double softSec = 0.0;
+    std::unique_ptr<FrameCapture> capture;
+    if (!opt.capture.empty() && opt.softEvery > 0) {
+        const int fps = std::max(1, (int)std::lround(1.0 / (opt.dt * opt.softEvery)));
+        capture.reset(new FrameCapture(opt.capture, opt.captureFormat, fps, true));
+    }
+    FILE* projectLog = nullptr;
+    if (!opt.projectLog.empty()) {
+        projectLog = std::fopen(opt.projectLog.c_str(), "w");
+        if (!projectLog) std::fprintf(stderr, "project: cannot write %s\n", opt.projectLog.c_str());
+        else std::fprintf(projectLog, "step,cycles,residual,div_before,div_after\n");
+    }
+
+    double puffSteps = 0.0;
+    auto t0 = std::chrono::steady_clock::now();
+    for (long i=0; i<opt.steps; ++i) {
+        puffSteps += (double)sim.puffs.size();
+        sim.step(opt.dt);
+        if (snaps && opt.snapshotEvery > 0 && sim.steps % (uint64_t)opt.snapshotEvery == 0) snaps->submit(sim);
+        if (tracking && sim.steps % (uint64_t)opt.trajectoryEvery == 0) tracks.append(sim);
+        if (projectLog) {
+            const ProjectStats& ps = sim.wind.projectStats;
+            std::fprintf(projectLog, "%ld,%d,%.3g,%.4g,%.4g\n", i, ps.lastCycles, ps.lastResidual, ps.divBefore, ps.divAfter);
+        }
+        if (opt.softEvery > 0 && (i + 1) % opt.softEvery == 0) {
+            auto r0 = std::chrono::steady_clock::now();
+            batch.clear();
+            if (opt.bgCache) {
+                appendForeground(batch, sim.puffs.view(), sim.winW, sim.winH);
+                soft.render(batch, fb, black, &pool, &background);
+            } else {
+                appendScene(batch, sim.puffs.view(), sim.winW, sim.winH);
+                soft.render(batch, fb, black, &pool);
+            }
+            softSec += std::chrono::duration<double>(std::chrono::steady_clock::now() - r0).count();
+            ++softFrames;
+            if (capture) {
+                PROF_SCOPE(PH_CAPTURE);
+                CaptureFrame* f = capture->acquire(fb.w, fb.h, 3);
+                fb.toRGB8(f->px.data());
+                capture->submit(f);
+            }
+        }
+        g_prof.endFrame();
+    }
+    double sec = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+    sec = std::max(sec, 1e-9);
+    if (snaps) snaps->writeNow(sim);
+    std::printf("headless: %ld steps of %.4f s on %d threads in %.3f s → %.0f steps/s, %.3g puffs/s, final population %zu\n",
+                opt.steps, opt.dt, pool.size(), sec, opt.steps/sec, puffSteps/sec, sim.puffs.size());
+    if (sim.coalesce)
+        std::printf("coalescence: %llu merges, %llu splits\n",
+                    (unsigned long long)sim.mergeStats.merges, (unsigned long long)sim.mergeStats.splits);
+    if (sim.windOn)
+        std::printf("wind: %dx%d cells, peak buoyant updraft %.1f px/s\n", sim.wind.nx, sim.wind.ny, sim.wind.peakUpdraft());
+    if (sim.windOn && sim.wind.projectOn) {
+        const ProjectStats& ps = sim.wind.projectStats;
+        std::printf("projection: %d levels, %.2f V-cycles/step (max %d), worst residual %.2g, rms divergence %.3g → %.3g 1/s\n",
+                    sim.wind.poisson.levels(), ps.solves ? (double)ps.cycles / ps.solves : 0.0, ps.maxCycles,
+                    ps.worstResidual, ps.divBefore, ps.divAfter);
+    }
+    if (projectLog) std::fclose(projectLog);
+    if (tracking) {
+        std::printf("trajectory: %llu frames, %.1f MB in %s (+ .idx), %llu extents mapped\n",
+                    (unsigned long long)tracks.frames(), tracks.bytes() / 1048576.0, tracks.path().c_str(),
+                    (unsigned long long)tracks.extents());
+        tracks.close();
+    }
+    if (snaps) {
+        const SnapStats ss = snaps->stats();
+        std::printf("snapshots: %llu written to %s (last %.1f KB → %.1f KB), %llu skipped while busy, %llu failed\n",
+                    (unsigned long long)ss.written, snaps->path().c_str(), ss.rawBytes / 1024.0, ss.storedBytes / 1024.0,
+                    (unsigned long long)ss.skipped, (unsigned long long)ss.failed);
+    }
+    if (sim.atmosOn)
+        std::printf("atmosphere: %dx%d cells, %llu puffs seeded, cloudy cells %.1f%%\n", sim.atmos.nx, sim.atmos.ny,
+                    (unsigned long long)sim.atmos.seeded, 100.f*sim.atmos.cloudFraction());
+    if (softFrames > 0) {
+        std::printf("soft render: %ld frames at %dx%d in %.3f s → %.1f frames/s (%.2f ms/frame)\n",
+                    softFrames, fb.w, fb.h, softSec, softFrames/std::max(softSec, 1e-9), 1e3*softSec/softFrames);
+        if (!opt.softOut.empty() && fb.writePPM(opt.softOut.c_str()))
+            std::printf("soft render: wrote %s\n", opt.softOut.c_str());
+    }
+    if (capture) {
+        capture->flush();
+        printCaptureStats(*capture);
+    }
+    if (g_prof.enabled) {
+        g_prof.printSummary(stdout);
+        if (!opt.profileOut.empty()) g_prof.dump(opt.profileOut.c_str());
+    }
+    return 0;
+}
+
+// ---------- ensemble driver ----------
+// Many independent headless runs in one process, for parameter sweeps. Each
+// member is one chunk on the task pool: a worker builds the member's
+// Simulation, steps it single-threaded to the end, and keeps only its summary.
+// Memory therefore scales with threads, not members, and stealing keeps cores
+// busy when some members grow larger populations than others. Members share
+// the read-only tables (saturation curve, ring profiles) and nothing else.
+// Member k gets seed + k and point k + 1 of a Halton sequence (bases 2, 3, 5, 7)
+// across the swept ranges. Results do not depend on the thread count.
+struct EnsembleMember {
+    uint64_t seed;
+    float rate, breeze, growth, life;    // rate, growth, life: multipliers; breeze: px/s
+    float cover = 0.f;                   // mean fraction of the domain under a puff
+    float altitude = 0.f;                // mean puff height, px
+    size_t peak = 0;                     // largest population seen
+    double puffSteps = 0.0;
+};
+
+static float halton(uint32_t i, uint32_t base) {
+    float f = 1.f, r = 0.f;
+    for (; i; i /= base) { f /= base; r += f * (i % base); }
+    return r;
+}
+
+// Share of a kCoverX x kCoverY lattice of the domain whose points lie inside a puff.
+static float cloudCover(const PuffField& P, int winW, int winH, std::vector<uint8_t>& mask) {
+    enum { kCoverX = 96, kCoverY = 60 };
+    mask.assign(kCoverX * kCoverY, 0);
+    const float sx = (float)winW / kCoverX, sy = (float)winH / kCoverY;
+    for (size_t k=0; k<P.size(); ++k) {
+        const float x = P.x[k], y = P.y[k], r = P.r[k];
+        const int i0 = std::max(0, (int)std::ceil((x - r) / sx - 0.5f)), i1 = std::min(kCoverX - 1, (int)((x + r) / sx - 0.5f));
+        const int j0 = std::max(0, (int)std::ceil((y - r) / sy - 0.5f)), j1 = std::min(kCoverY - 1, (int)((y + r) / sy - 0.5f));
+        for (int j=j0; j<=j1; ++j) {
+            const float dy = (j + 0.5f)*sy - y;
+            for (int i=i0; i<=i1; ++i) {
+                const float dx = (i + 0.5f)*sx - x;
+                if (dx*dx + dy*dy < r*r) mask[j*kCoverX + i] = 1;
+            }
+        }
+    }
+    size_t n = 0;
+    for (uint8_t m : mask) n += m;
+    return (float)n / mask.size();
+}
+
+// Cover and altitude are averaged over the second half of the run, sampled
+// every kSampleEvery steps, so the spin-up from an empty sky is left out.
+static void runMember(EnsembleMember& m, const Options& opt, std::vector<uint8_t>& mask) {
+    const long kSampleEvery = 30;
+    Simulation sim(opt.winW, opt.winH, m.seed);
+    configureSimulation(sim, opt);
+    for (auto& e : sim.emitters) { e.rate *= m.rate; e.growth = m.growth; e.life = m.life; }
+    sim.breeze = m.breeze;
+    double cover = 0.0, altitude = 0.0, altSamples = 0.0;
+    long samples = 0;
+    for (long i=0; i<opt.steps; ++i) {
+        m.puffSteps += (double)sim.puffs.size();
+        sim.step(opt.dt);
+        const PuffField& P = sim.puffs;
+        m.peak = std::max(m.peak, P.size());
+        if (2*(i + 1) > opt.steps && (opt.steps - 1 - i) % kSampleEvery == 0) {
+            cover += cloudCover(P, sim.winW, sim.winH, mask);
+            for (size_t k=0; k<P.size(); ++k) altitude += P.y[k];
+            altSamples += (double)P.size();
+            ++samples;
+        }
+    }
+    m.cover = samples ? (float)(cover / samples) : 0.f;
+    m.altitude = altSamples > 0.0 ? (float)(altitude / altSamples) : 0.f;
+}
+
+static int runEnsemble(const Options& opt, uint64_t seed) {
+    const int members = opt.ensemble;
+    std::vector<EnsembleMember> M((size_t)members);
+    auto sweep = [](const SweepRange& s, uint32_t k, uint32_t base) { return s.lo + (s.hi - s.lo) * halton(k + 1, base); };
+    for (int k=0; k<members; ++k) {
+        EnsembleMember& m = M[k];
+        m.seed = seed + (uint64_t)k;
+        m.rate   = sweep(opt.sweepRate,   (uint32_t)k, 2);
+        m.breeze = sweep(opt.sweepBreeze, (uint32_t)k, 3);
+        m.growth = sweep(opt.sweepGrowth, (uint32_t)k, 5);
+        m.life   = sweep(opt.sweepLife,   (uint32_t)k, 7);
+    }
+    TaskPool pool(threadCount(opt));
+    std::vector<std::vector<uint8_t>> masks((size_t)pool.size());
+    auto t0 = std::chrono::steady_clock::now();
+    pool.parallelFor((size_t)members, [&](size_t k, int w) { runMember(M[k], opt, masks[w]); });
+    const double sec = std::max(1e-9, std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count());
+
+    double puffSteps = 0.0;
+    float coverLo = 1.f, coverHi = 0.f, altLo = 1e30f, altHi = 0.f;
+    double coverSum = 0.0, altSum = 0.0, peakSum = 0.0;
+    size_t peakHi = 0;
+    for (const EnsembleMember& m : M) {
+        puffSteps += m.puffSteps;
+        coverLo = std::min(coverLo, m.cover); coverHi = std::max(coverHi, m.cover); coverSum += m.cover;
+        altLo = std::min(altLo, m.altitude); altHi = std::max(altHi, m.altitude); altSum += m.altitude;
+        peakHi = std::max(peakHi, m.peak); peakSum += (double)m.peak;
+    }
+    const double memberSteps = (double)members * opt.steps;
+    std::printf("ensemble: %d members x %ld steps of %.4f s on %d threads in %.3f s → %.0f member-steps/s, %.3g puffs/s\n",
+                members, opt.steps, opt.dt, pool.size(), sec, memberSteps / sec, puffSteps / sec);
+    std::printf("  cloud cover   %6.1f%% .. %6.1f%%  (mean %.1f%%)\n", 100.f*coverLo, 100.f*coverHi, 100.0*coverSum/members);
+    std::printf("  mean altitude %6.0f .. %6.0f px (mean %.0f)\n", altLo, altHi, altSum/members);
+    std::printf("  peak puffs    up to %zu (mean %.0f)\n", peakHi, peakSum/members);
+
+    if (!opt.ensembleOut.empty()) {
+        FILE* f = std::fopen(opt.ensembleOut.c_str(), "w");
+        if (!f) { std::fprintf(stderr, "ensemble: cannot write %s\n", opt.ensembleOut.c_str()); return 1; }
+        std::fprintf(f, "member,seed,rate,breeze,growth,life,cloud_cover,mean_altitude,peak_puffs\n");
+        for (int k=0; k<members; ++k) {
+            const EnsembleMember& m = M[k];
+            std::fprintf(f, "%d,%llu,%.4g,%.4g,%.4g,%.4g,%.5f,%.2f,%zu\n", k, (unsigned long long)m.seed,
+                         m.rate, m.breeze, m.growth, m.life, m.cover, m.altitude, m.peak);
+        }
+        std::fclose(f);
+        std::printf("ensemble: wrote %s\n", opt.ensembleOut.c_str());
+    }
+    return 0;
+}
+
+// Update-kernel scaling: for each population, time updatePuffs on 1..all threads
+// from the same seeded start. The checksum over the final columns must match
+// across thread counts.
+static int runThreadBench(const Options& opt, uint64_t seed) {
+    const int maxThreads = (int)std::max(1u, std::thread::hardware_concurrency());
+    std::vector<int> counts;
+    for (int t=1; t<maxThreads; t*=2) counts.push_back(t);
+    counts.push_back(maxThreads);
+    const int kSteps = 10;
+    const StepParams sp{ 1.f/60.f, 12.f, (float)opt.winW, (float)opt.winH, WindView() };
+    std::printf("%10s %8s %12s %12s %8s %18s\n", "puffs", "threads", "ms/step", "Mpuffs/s", "speedup", "checksum");
+    for (long n : opt.benchThreadSizes) {
+        double base = 0.0;
+        for (int t : counts) {
+            PuffField P;
+            P.setBudget((size_t)n, OVERFLOW_DROP_NEWEST);
+            Rng rng(seed);
+            Emitter domain{ 0.f, (float)opt.winW, 0.f, 0.f };
+            spawnPuffs(P, domain, (int)n, rng);
+            for (size_t i=0; i<P.size(); ++i) P.y[i] = rng.uniform() * opt.winH;   // spread vertically
+            TaskPool pool(t);
+            UpdateScratch scratch;
+            updatePuffs(P, sp, RETIRE_SWAP, scratch, &pool);   // warm caches and scratch
+            auto t0 = std::chrono::steady_clock::now();
+            for (int k=0; k<kSteps; ++k) updatePuffs(P, sp, RETIRE_SWAP, scratch, &pool);
+            double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - t0).count() / kSteps;
+            if (t == 1) base = ms;
+            uint64_t sum = 0;
+            P.forEachColumn([&](auto& c){
+                for (auto v : c) { uint32_t b; std::memcpy(&b, &v, 4); sum = sum*31 + b; }
+            });
+            std::printf("%10ld %8d %12.3f %12.1f %8.2f %18llx\n", n, t, ms, n / ms / 1000.0,
+                        base / ms, (unsigned long long)sum);
+        }
+    }
+    return 0;
+}
+
+// Runs cases whose name contains --bench-kernels=FILTER (all by default);
+// --bench-out keeps a CSV copy for comparing runs.
+static int runKernelBenchmarks(const Options& opt) {
+    std::vector<BenchCase> cases = kernelBenchmarks(opt.winW, opt.winH);
+    FILE* csv = nullptr;
+    if (!opt.benchOut.empty()) {
+        csv = std::fopen(opt.benchOut.c_str(), "w");
+        if (!csv) std::fprintf(stderr, "bench: cannot write %s\n", opt.benchOut.c_str());
+        else std::fprintf(csv, "name,iterations,ns_per_iter,items_per_sec\n");
+    }
+    std::printf("%-44s %14s %12s %14s\n", "Benchmark", "Time", "Iterations", "items/s");
+    std::printf("%s\n", std::string(87, '-').c_str());
+    for (BenchCase& c : cases) {
+        if (!opt.benchFilter.empty() && c.name.find(opt.benchFilter) == std::string::npos) continue;
+        // Grow the iteration count until one run lasts long enough to trust.
+        int64_t iters = 1;
+        BenchState st(iters);
+        for (;;) {
+            st = BenchState(iters);
+            c.fn(st);
+            double sec = st.seconds();
+            const int64_t kMaxIters = (int64_t)1 << 30;
+            if (sec >= kMinBenchTime || iters >= kMaxIters) break;
+            double grow = sec > 0.0 ? 1.4 * kMinBenchTime / sec : 100.0;
+            iters = std::min(kMaxIters, std::max(iters + 1, (int64_t)(iters * std::min(100.0, grow))));
+        }
+        double per = st.seconds() / st.iterations();
+        double ips = st.items() ? st.items() / st.seconds() : 0.0;
+        char t[32]; printBenchTime(t, sizeof t, per);
+        std::printf("%-44s %14s %12lld %14.4g\n", c.name.c_str(), t, (long long)st.iterations(), ips);
+        if (csv) std::fprintf(csv, "%s,%lld,%.3f,%.6g\n", c.name.c_str(), (long long)st.iterations(), per*1e9, ips);
     }
+#ifndef CLOUD_STUB_GL
+    std::printf("(drawSoftBlob/drawClouds/fillRectGradient cases need a -DCLOUD_STUB_GL build)\n");
+#endif
+    if (csv) std::fclose(csv);
+    return 0;
 }
 
 // ---------- main ----------
 int main(int argc, char** argv) {
-    (void)argc; (void)argv;
-    srand((unsigned)time(nullptr));
+    const Options opt = parseArgs(argc, argv);
+    g_render = opt.render;
+    const uint64_t seed = opt.hasSeed ? opt.seed : (uint64_t)time(nullptr);
+    std::printf("seed: %llu\n", (unsigned long long)seed);   // replay with --seed
+    if (opt.ensemble > 0) return runEnsemble(opt, seed);   // members step concurrently: no profiler
+    if (opt.profile) g_prof.start();
+    if (!opt.readTrajectory.empty()) return runTrajectoryReport(opt.readTrajectory);
+    if (opt.benchKernels) return runKernelBenchmarks(opt);
+    if (!opt.benchThreadSizes.empty()) return runThreadBench(opt, seed);
+    if (opt.headless) return runHeadless(opt, seed);
+#ifdef CLOUD_STUB_GL
+    std::fprintf(stderr, "built with -DCLOUD_STUB_GL: only --headless and --bench-* modes are available\n");
+    return 1;
+#endif
 
     if (SDL_Init(SDL_INIT_VIDEO | SDL_INIT_TIMER) != 0) {
         std::fprintf(stderr, "SDL_Init failed: %s\n", SDL_GetError());
@@ -170,7 +4661,7 @@ int main(int argc, char** argv) {
     SDL_GL_SetAttribute(SDL_GL_BLUE_SIZE,  8);
     SDL_GL_SetAttribute(SDL_GL_DEPTH_SIZE, 16);
 
-    int winW = 960, winH = 600;
+    int winW = opt.winW, winH = opt.winH;
     SDL_Window* win = SDL_CreateWindow(
         "Cloud Formation — SDL2 + OpenGL ES 1.1",
         SDL_WINDOWPOS_CENTERED, SDL_WINDOWPOS_CENTERED,
@@ -207,99 +4698,290 @@ int main(int argc, char** argv) {
         glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
     };
     setOrtho(winW, winH);
+    g_sprites = detectPointSprites();
+    StreamBuffers streams;
+    StaticBackground background;
+    BackgroundCache bgCache;
+    if (opt.vbo) {
+        streams.init();
+        g_stream = &streams;
+        background.build(winW, winH);
+    }
+    if (g_sprites.supported) std::printf("point sprites: up to %.0f px\n", g_sprites.maxSize);
+    else if (g_render == RENDER_SPRITE) std::printf("point sprites unavailable; sprite backend draws splat quads\n");
 
-    // Emitters representing moist thermals / convergence lines
-    std::vector<Emitter> emitters = {
-        { winW*0.18f, winW*0.38f, 110.f, 4.0f },  // left thermal
-        { winW*0.55f, winW*0.82f, 110.f, 3.2f }   // right thermal
+    TaskPool pool(threadCount(opt));
+    Simulation sim(winW, winH, seed);
+    configureSimulation(sim, opt);
+    sim.pool = &pool;
+    if (!opt.restore.empty() && !restoreFromFile(sim, opt.restore, winW, winH)) {
+        SDL_GL_DeleteContext(ctx);
+        SDL_DestroyWindow(win);
+        SDL_Quit();
+        return 1;
+    }
+    std::unique_ptr<SnapshotWriter> snaps;
+    if (!opt.snapshot.empty()) snaps.reset(new SnapshotWriter(opt.snapshot));
+    TrajectoryWriter tracks;
+    const bool tracking = !opt.trajectory.empty() && tracks.open(opt.trajectory, winW, winH);
+    // Runs after every step, on whichever thread steps sim.
+    auto afterStep = [&](const Simulation& s) {
+        if (snaps && opt.snapshotEvery > 0 && s.steps % (uint64_t)opt.snapshotEvery == 0) snaps->submit(s);
+        if (tracking && s.steps % (uint64_t)opt.trajectoryEvery == 0) tracks.append(s);
     };
-    float emitterTimerA=0.f, emitterTimerB=0.f;
-
-    std::vector<Puff> puffs;
+    std::unique_ptr<FrameCapture> capture;
+    if (!opt.capture.empty()) capture.reset(new FrameCapture(opt.capture, opt.captureFormat, 60, false));
+    PuffField& puffs = sim.puffs;
     bool running = true;
     Uint32 lastTicks = SDL_GetTicks();
-    float breeze = 12.f;  // pixels/sec → “wind”
-
-    auto drawScene = [&](float timeSec) {
-        glClearColor(0.f, 0.f, 0.f, 1.f);
-        glClear(GL_COLOR_BUFFER_BIT);
-
-        // --- Sky gradient ---
-        GLfloat top[4]    = {0.42f, 0.66f, 0.95f, 1.f};
-        GLfloat mid[4]    = {0.62f, 0.78f, 0.98f, 1.f};
-        GLfloat near[4]   = {0.78f, 0.86f, 0.99f, 1.f};
-        fillRectGradient(0, winH*0.45f, (GLfloat)winW, winH*0.55f, top, top, mid, mid);
-        fillRectGradient(0, 0, (GLfloat)winW, winH*0.45f, mid, mid, near, near);
-
-        // --- Horizon & ground ---
-        GLfloat ground[4] = {0.40f, 0.55f, 0.35f, 1.f};
-        fillRect(0, 0, (GLfloat)winW, 110.f, ground);
-
-        // Distant hills (simple darker strips)
-        GLfloat hill1[4]={0.33f,0.47f,0.32f,1.f};
-        fillRect(0, 110.f, (GLfloat)winW, 18.f, hill1);
-        GLfloat hill2[4]={0.28f,0.42f,0.30f,1.f};
-        fillRect(0, 128.f, (GLfloat)winW, 12.f, hill2);
-
-        // --- Clouds ---
-        drawClouds(puffs);
-
-        // Optional faint sun haze
-        GLfloat sunRGB[3] = {1.0f, 0.98f, 0.88f};
-        drawSoftBlob(winW*0.82f, winH*0.80f, 60.f, sunRGB, 0.06f, 10);
+
+    TriBatch cloudBatch;   // reused every frame by the batched backend
+    SplatBatch cloudSplats, sunSplat;   // and by the splat and sprite backends
+    std::vector<SpriteVertex> cloudSprites;
+
+    auto drawScene = [&](const PuffView& clouds) {
+        const bool cached = opt.bgCache && bgCache.valid;
+        {
+            PROF_SCOPE(PH_SKY);
+            glClearColor(0.f, 0.f, 0.f, 1.f);
+            glClear(GL_COLOR_BUFFER_BIT);
+
+            // --- Sky gradient ---
+            if (cached) bgCache.blit();   // sky, ground and hills
+            else if (g_stream) background.draw(0, kSkyIndices);
+            else {
+                fillRectGradient(0, winH*0.45f, (GLfloat)winW, winH*0.55f, kSkyTop, kSkyTop, kSkyMid, kSkyMid);
+                fillRectGradient(0, 0, (GLfloat)winW, winH*0.45f, kSkyMid, kSkyMid, kSkyNear, kSkyNear);
+            }
+        }
+        if (!cached) {
+            PROF_SCOPE(PH_GROUND);
+            if (g_stream) background.draw(kSkyIndices, kGroundIndices);
+            else {
+                // --- Horizon & ground ---
+                fillRect(0, 0, (GLfloat)winW, 110.f, kGround);
+
+                // Distant hills (simple darker strips)
+                fillRect(0, 110.f, (GLfloat)winW, 18.f, kHill1);
+                fillRect(0, 128.f, (GLfloat)winW, 12.f, kHill2);
+            }
+            if (opt.bgCache) bgCache.capture(winW, winH);
+        }
+
+        // --- Clouds + optional faint sun haze ---
+        // The haze sits above the clouds, so it cannot join the cached layer; with
+        // --bg-cache it is one splat quad instead of ten overdrawn rings.
+        const bool sunSplatted = opt.bgCache || g_render == RENDER_SPLAT || g_render == RENDER_SPRITE;
+        if (g_render == RENDER_BATCHED) {
+            {
+                PROF_SCOPE(PH_CLOUDS);
+                cloudBatch.clear();
+                appendClouds(cloudBatch, clouds);
+            }
+            if (!sunSplatted) {
+                PROF_SCOPE(PH_SUN);
+                appendSoftBlob(cloudBatch, winW*0.82f, winH*0.80f, 60.f, kSunRGB, 0.06f, 10);
+            }
+            PROF_SCOPE(PH_CLOUDS);
+            drawBatch(cloudBatch);
+        } else if (g_render == RENDER_SPLAT || g_render == RENDER_SPRITE) {
+            {
+                PROF_SCOPE(PH_CLOUDS);
+                cloudSplats.clear();
+                if (g_render == RENDER_SPRITE) {
+                    cloudSprites.clear();
+                    appendSpriteClouds(cloudSprites, cloudSplats, clouds, winW, winH, g_sprites.maxSize);
+                    drawSpriteBatch(cloudSprites, splatTexture(kPuffRings));
+                } else {
+                    appendSplatClouds(cloudSplats, clouds);
+                }
+                drawSplatBatch(cloudSplats, splatTexture(kPuffRings));
+            }
+        } else {
+            {
+                PROF_SCOPE(PH_CLOUDS);
+                drawClouds(clouds);
+            }
+            if (!sunSplatted) {
+                PROF_SCOPE(PH_SUN);
+                drawSoftBlob(winW*0.82f, winH*0.80f, 60.f, kSunRGB, 0.06f, 10);
+            }
+        }
+        if (sunSplatted) {
+            PROF_SCOPE(PH_SUN);
+            sunSplat.clear();
+            appendSplat(sunSplat, winW*0.82f, winH*0.80f, 60.f, kSunRGB, 0.06f, 10);
+            drawSplatBatch(sunSplat, splatTexture(10));
+        }
+    };
+
+    if (opt.benchFrames > 0) {
+        // Warm up to a steady population, then time the same frames with each blob path.
+        SDL_GL_SetSwapInterval(0);
+        for (int i=0; i<1800; ++i) sim.step(1.f/60.f);
+        const PuffField frozen = puffs;
+        const double freq = (double)SDL_GetPerformanceFrequency();
+        const RenderBackend userRender = g_render;
+        for (int pass=0; pass<5; ++pass) {
+            static const RenderBackend passRender[5] = { RENDER_IMMEDIATE, RENDER_IMMEDIATE, RENDER_BATCHED, RENDER_SPLAT, RENDER_SPRITE };
+            g_useFanCache = (pass >= 1);
+            g_render = passRender[pass];
+            puffs = frozen;
+            Uint64 t0 = SDL_GetPerformanceCounter();
+            for (int f=0; f<opt.benchFrames; ++f) {
+                glLoadIdentity();
+                drawScene(puffs.view());
+                glFinish();
+                SDL_GL_SwapWindow(win);
+            }
+            double ms = (SDL_GetPerformanceCounter() - t0) * 1000.0 / freq / opt.benchFrames;
+            static const char* const passNames[5] = { "trig", "fan-cache", "batched", "splat", "sprite" };
+            std::printf("bench %-10s %zu puffs, %d frames: %.3f ms/frame\n",
+                        passNames[pass], puffs.size(), opt.benchFrames, ms);
+        }
+        g_render = userRender;
+        running = false;
+    }
+
+    // Decoupled mode: from here on only the sim thread touches sim.
+    std::unique_ptr<SimThread> simThread;
+    SnapshotInterpolator interp;
+    if (running && opt.simHz > 0.f) {
+        simThread.reset(new SimThread(sim, 1.f/opt.simHz));
+        simThread->setOnTick(afterStep);
+        simThread->start();
+    }
+    auto nudgeBreeze = [&](float d) { if (simThread) simThread->postBreeze(d); else sim.nudgeBreeze(d); };
+    auto humidity = [&](int d) {
+        if (simThread) simThread->postHumidity(d);
+        else if (d > 0) sim.raiseHumidity();
+        else sim.lowerHumidity();
     };
 
+    // Heap traffic is measured from the end of warmup, when the pool, batch and
+    // scratch buffers have reached their steady-state sizes.
+    const int kWarmupFrames = 300;
+    long frame = 0;
+    uint64_t allocsAtWarmup = 0;
+
     while (running) {
+        if (++frame == kWarmupFrames) allocsAtWarmup = g_allocCount.load();
         // events
-        SDL_Event ev;
-        while (SDL_PollEvent(&ev)) {
-            if (ev.type == SDL_QUIT) running = false;
-            else if (ev.type == SDL_WINDOWEVENT && ev.window.event == SDL_WINDOWEVENT_SIZE_CHANGED) {
-                winW = ev.window.data1; winH = ev.window.data2;
-                setOrtho(winW, winH);
-                // keep emitters anchored near ground
-                emitters[0].x0 = winW*0.18f; emitters[0].x1 = winW*0.38f; emitters[0].y = 110.f;
-                emitters[1].x0 = winW*0.55f; emitters[1].x1 = winW*0.82f; emitters[1].y = 110.f;
-            } else if (ev.type == SDL_KEYDOWN) {
-                if (ev.key.keysym.sym == SDLK_ESCAPE || ev.key.keysym.sym == SDLK_q) running = false;
-                if (ev.key.keysym.sym == SDLK_LEFT)  breeze -= 4.f;
-                if (ev.key.keysym.sym == SDLK_RIGHT) breeze += 4.f;
-                if (ev.key.keysym.sym == SDLK_UP) { // “humid day” → more emission
-                    for (auto& e: emitters) e.rate += 0.8f;
-                }
-                if (ev.key.keysym.sym == SDLK_DOWN) {
-                    for (auto& e: emitters) e.rate = std::max(0.6f, e.rate - 0.8f);
+        {
+            PROF_SCOPE(PH_EVENTS);
+            SDL_Event ev;
+            while (SDL_PollEvent(&ev)) {
+                if (ev.type == SDL_QUIT) running = false;
+                else if (ev.type == SDL_WINDOWEVENT && ev.window.event == SDL_WINDOWEVENT_SIZE_CHANGED) {
+                    winW = ev.window.data1; winH = ev.window.data2;
+                    setOrtho(winW, winH);
+                    if (g_stream) background.build(winW, winH);
+                    bgCache.invalidate();
+                    if (simThread) simThread->postResize(winW, winH);
+                    else sim.resize(winW, winH);
+                } else if (ev.type == SDL_KEYDOWN) {
+                    if (ev.key.keysym.sym == SDLK_ESCAPE || ev.key.keysym.sym == SDLK_q) running = false;
+                    if (ev.key.keysym.sym == SDLK_b) {  // A/B the render backends
+                        g_render = (RenderBackend)((g_render + 1) % RENDER_COUNT);
+                        std::printf("render backend: %s\n", kRenderNames[g_render]);
+                    }
+                    if (ev.key.keysym.sym == SDLK_p) {  // frame-time overlay
+                        if (!g_prof.enabled) g_prof.start();
+                        g_prof.overlay = !g_prof.overlay;
+                    }
+                    if (ev.key.keysym.sym == SDLK_LEFT)  nudgeBreeze(-4.f);
+                    if (ev.key.keysym.sym == SDLK_RIGHT) nudgeBreeze(+4.f);
+                    if (ev.key.keysym.sym == SDLK_UP)    humidity(+1);
+                    if (ev.key.keysym.sym == SDLK_DOWN)  humidity(-1);
                 }
             }
         }
 
-        // timing
-        Uint32 now = SDL_GetTicks();
-        float dt = (now - lastTicks) * 0.001f;
-        lastTicks = now;
-        dt = clampf(dt, 0.0f, 0.033f); // clamp to keep stable
+        PuffView clouds;
+        if (simThread) {
+            // draw one tick behind the sim so there are always two snapshots to blend
+            clouds = interp.view(simThread->snapshots(), simThread->wallTime() - simThread->tick());
+        } else {
+            // timing
+            Uint32 now = SDL_GetTicks();
+            float dt = (now - lastTicks) * 0.001f;
+            lastTicks = now;
+            dt = clampf(dt, 0.0f, 0.033f); // clamp to keep stable
 
-        // spawn puffs from emitters (Poisson-ish)
-        emitterTimerA += dt*emitters[0].rate;
-        while (emitterTimerA >= 1.f) { spawnPuff(puffs, emitters[0], winW, winH); emitterTimerA -= 1.f; }
-        emitterTimerB += dt*emitters[1].rate;
-        while (emitterTimerB >= 1.f) { spawnPuff(puffs, emitters[1], winW, winH); emitterTimerB -= 1.f; }
-
-        // occasionally seed mid-level moisture to hint anvils/merging
-        if (frand() < 0.02f*dt*60.f) {
-            Emitter mid{ winW*0.30f, winW*0.70f, winH*0.45f + frand()*50.f, 1.0f };
-            spawnPuff(puffs, mid, winW, winH);
+            sim.step(dt);
+            afterStep(sim);
+            clouds = puffs.view();
         }
 
-        // update “atmosphere”
-        updatePuffs(puffs, dt, breeze, winW, winH);
-
         // draw
         glLoadIdentity();
-        drawScene(now*0.001f);
+        drawScene(clouds);
+        if (capture) {
+            // ES 1.1 has no pixel buffer objects, so this read is synchronous; the
+            // encoding and the file writes are what it keeps off this thread.
+            PROF_SCOPE(PH_CAPTURE);
+            if (CaptureFrame* f = capture->acquire(winW, winH, 4)) {
+                glReadPixels(0, 0, winW, winH, GL_RGBA, GL_UNSIGNED_BYTE, f->px.data());
+                f->bottomUp = true;
+                capture->submit(f);
+            }
+        }
+        if (g_prof.overlay) drawProfileOverlay(g_prof, winW, winH);
+
+        {
+            PROF_SCOPE(PH_SWAP);
+            SDL_GL_SwapWindow(win);
+        }
+        g_prof.endFrame();
+    }
 
-        SDL_GL_SwapWindow(win);
+    if (simThread) simThread->stop();
+    if (snaps) snaps->writeNow(sim);
+    if (capture) capture->flush();
+    if (g_prof.enabled) {
+        g_prof.printSummary(stdout);
+        if (!opt.profileOut.empty()) g_prof.dump(opt.profileOut.c_str());
+    }
+    const PoolStats& ps = puffs.stats;
+    std::printf("puff pool: budget %zu, spawned %llu, dropped oldest %llu, dropped newest %llu, grown %llu\n",
+                puffs.budget, (unsigned long long)ps.spawned, (unsigned long long)ps.droppedOldest,
+                (unsigned long long)ps.droppedNewest, (unsigned long long)ps.grown);
+    if (sim.coalesce)
+        std::printf("coalescence: %llu merges, %llu splits\n",
+                    (unsigned long long)sim.mergeStats.merges, (unsigned long long)sim.mergeStats.splits);
+    if (sim.windOn)
+        std::printf("wind: %dx%d cells, peak buoyant updraft %.1f px/s\n", sim.wind.nx, sim.wind.ny, sim.wind.peakUpdraft());
+    if (sim.windOn && sim.wind.projectOn) {
+        const ProjectStats& ps = sim.wind.projectStats;
+        std::printf("projection: %d levels, %.2f V-cycles/step (max %d), worst residual %.2g, rms divergence %.3g → %.3g 1/s\n",
+                    sim.wind.poisson.levels(), ps.solves ? (double)ps.cycles / ps.solves : 0.0, ps.maxCycles,
+                    ps.worstResidual, ps.divBefore, ps.divAfter);
+    }
+    if (sim.atmosOn)
+        std::printf("atmosphere: %dx%d cells, %llu puffs seeded, cloudy cells %.1f%%\n", sim.atmos.nx, sim.atmos.ny,
+                    (unsigned long long)sim.atmos.seeded, 100.f*sim.atmos.cloudFraction());
+    if (snaps) {
+        const SnapStats ss = snaps->stats();
+        std::printf("snapshots: %llu written to %s (last %.1f KB → %.1f KB), %llu skipped while busy, %llu failed\n",
+                    (unsigned long long)ss.written, snaps->path().c_str(), ss.rawBytes / 1024.0, ss.storedBytes / 1024.0,
+                    (unsigned long long)ss.skipped, (unsigned long long)ss.failed);
+    }
+    if (tracking) {
+        std::printf("trajectory: %llu frames, %.1f MB in %s (+ .idx), %llu extents mapped\n",
+                    (unsigned long long)tracks.frames(), tracks.bytes() / 1048576.0, tracks.path().c_str(),
+                    (unsigned long long)tracks.extents());
+        tracks.close();
+    }
+    if (capture) printCaptureStats(*capture);
+    if (g_stream) {
+        std::printf("vbo: streamed %.1f MB of vertices and %.1f MB of indices, %llu orphans\n",
+                    streams.verts.bytes / 1048576.0, streams.idx.bytes / 1048576.0,
+                    (unsigned long long)(streams.verts.orphans + streams.idx.orphans));
+        g_stream = nullptr;
     }
+    if (frame > kWarmupFrames)
+        std::printf("heap allocations after warmup: %llu over %ld frames\n",
+                    (unsigned long long)(g_allocCount.load() - allocsAtWarmup), frame - kWarmupFrames);
 
     SDL_GL_DeleteContext(ctx);
     SDL_DestroyWindow(win);